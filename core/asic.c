@@ -54,6 +54,7 @@ static void plug_devices(void) {
     port_map[0xD] = init_dxxx();
     port_map[0xE] = init_exxx();
     port_map[0xF] = init_fxxx();
+    port_build_tables();
 
     reset_proc_count = 0;
 
@@ -86,6 +87,7 @@ void asic_free(void) {
     /* make sure the LCD doesn't use unalloced mem */
     lcd.upcurr = lcd.upbase = 0;
     mem_free();
+    port_free_tables();
     gui_console_printf("[CEmu] Freed ASIC.\n");
 }
 
@@ -94,6 +96,7 @@ void asic_reset(void) {
 
     sched.clockRates[CLOCK_CPU] = 48000000;
     sched.clockRates[CLOCK_APB] = 78000000;
+    sched_update_rates();
 
     for(i = 0; i < reset_proc_count; i++) {
         reset_procs[i]();
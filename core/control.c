@@ -71,6 +71,7 @@ static void control_write(const uint16_t pio, const uint8_t byte, bool poke) {
             if (byte & 0x10) {
                 gui_console_printf("[CEmu] Reset caused by writing to bit 5 of port 0. PC: %#06x\n", cpu.registers.PC);
                 cpuEvents |= EVENT_RESET;
+                cpu.next = cpu.cycles; /* take effect after this instruction */
 #ifdef DEBUG_SUPPORT
                 if (debugger.resetOpensDebugger) {
                     open_debugger(DBG_MISC_RESET, cpu.registers.PC);
@@ -132,6 +133,7 @@ static void control_write(const uint16_t pio, const uint8_t byte, bool poke) {
                 asic.shipModeEnabled = true;
                 control.ports[0] |= 0x40; // Turn calc off
                 cpuEvents |= EVENT_RESET;
+                cpu.next = cpu.cycles;
                 gui_console_printf("[CEmu] Reset caused by entering sleep mode.\n", cpu.registers.PC);
 #ifdef DEBUG_SUPPORT
                 if (debugger.resetOpensDebugger) {
@@ -159,15 +161,18 @@ static void control_write(const uint16_t pio, const uint8_t byte, bool poke) {
             break;
         case 0x20: case 0x21: case 0x22:
             write8(control.protectedStart, (index - 0x20) << 3, byte);
+            mem_update_map();
             break;
         case 0x23: case 0x24: case 0x25:
             write8(control.protectedEnd, (index - 0x23) << 3, byte);
+            mem_update_map();
             break;
         case 0x28:
             control.ports[index] = byte & 247;
             break;
         case 0x3A: case 0x3B: case 0x3C:
             write8(control.stackLimit, (index - 0x3A) << 3, byte);
+            mem_update_map();
             break;
         case 0x3E:
             control.protectionStatus &= ~byte;
@@ -193,6 +198,7 @@ eZ80portrange_t init_control(void) {
     control.privileged = 0xFFFFFF;
     control.protectedStart = control.protectedEnd = 0xD1887C;
     control.protectionStatus = 0;
+    mem_update_map();
 
     return device;
 }
@@ -204,6 +210,7 @@ bool control_save(emu_image *s) {
 
 bool control_restore(const emu_image *s) {
     control = s->control;
+    mem_update_map();
     return true;
 }
 
@@ -24,16 +24,50 @@
 #include "cpu.h"
 #include "emu.h"
 #include "mem.h"
+#include "dma.h"
+#include "flash.h"
 #include "registers.h"
 #include "interrupt.h"
 #include "debug/debug.h"
 
+/* Debug builds compile this file a second time through cpu_lean.c, without the
+ * debugger hooks, and only run the instrumented copy while something is being debugged */
+#ifdef CPU_LEAN
+#define mem_read_cpu    mem_read_cpu_lean
+#define mem_write_cpu   mem_write_cpu_lean
+#define port_read_byte  port_read_byte_lean
+#define port_write_byte port_write_byte_lean
+#else
 /* Global CPU state */
 eZ80cpu_t cpu;
+#endif
+
+/* Breakpoints need to see every fetch, so only cache decodes without them */
+#if !defined(DEBUG_SUPPORT) && !defined(NO_DECODE_CACHE)
+#define DECODE_CACHE
+#endif
+
+/* Idle loops are fast forwarded, which the debugger would have to step through */
+#if !defined(DEBUG_SUPPORT) && !defined(NO_IDLE_SKIP)
+#define IDLE_SKIP
+#endif
+
+/* Optionally defer 8-bit alu flags until something reads them, which the debugger would see */
+#if defined(LAZY_FLAGS) && !defined(DEBUG_SUPPORT) && !defined(CPU_LEAN)
+#define CPU_LAZY_FLAGS
+#endif
+
+/* Dispatch opcodes through label tables where the compiler supports computed goto */
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define CPU_THREADED
+#define CPU_OP(name) op_##name:
+#else
+#define CPU_OP(name)
+#endif
 
 static void cpu_clear_mode(void) {
 #ifdef DEBUG_SUPPORT
-    debugger.data.block[cpu.registers.PC] |= DBG_INST_START_MARKER;
+    debug_map_set(&debugger.data.markers, cpu.registers.PC, DBG_INST_START_MARKER);
 #endif
     cpu.PREFIX = cpu.SUFFIX = 0;
     cpu.L = cpu.ADL;
@@ -46,21 +80,514 @@ static uint32_t cpu_address_mode(uint32_t address, bool mode) {
     }
     return (cpu.registers.MBASE << 16) | (address & 0xFFFF);
 }
+
+/* Flag builders after the eight alu operations */
+#define CPU_FLAGS_ROT 8     /* rotates and shifts, C is kept */
+#define CPU_FLAGS_CPI 9     /* CPI, CPD, CPIR, CPDR, P/V and C are kept */
+
+/* Flags of alu[i] with A = old, operand v and carry in c, kept holds bits 3 and 5
+ * and whatever the operation doesn't compute */
+static uint8_t cpu_alu_flags(int i, uint8_t old, uint8_t v, uint8_t c, uint8_t result, uint8_t kept) {
+    uint8_t flags = cpuflag_sign_b(result) | cpuflag_zero(result) | kept;
+    switch (i) {
+        case 0: // ADD A, v
+        case 1: // ADC A, v
+            return flags | cpuflag_overflow_b_add(old, v, result)
+                | cpuflag_subtract(0) | cpuflag_carry_b(old + v + c)
+                | cpuflag_halfcarry_b_add(old, v, c);
+        case 2: // SUB v
+        case 3: // SBC v
+        case 7: // CP v
+            return flags | cpuflag_overflow_b_sub(old, v, result)
+                | cpuflag_subtract(1) | cpuflag_carry_b(old - v - c)
+                | cpuflag_halfcarry_b_sub(old, v, c);
+        case 4: // AND v
+            return flags | cpuflag_parity(result) | FLAG_H;
+        case CPU_FLAGS_CPI: // A = old, (HL) = v
+            return flags | cpuflag_subtract(1) | cpuflag_halfcarry_b_sub(old, v, 0);
+        default: // XOR v, OR v, rotates and shifts
+            return flags | cpuflag_parity(result);
+    }
+}
+
+#ifdef CPU_LAZY_FLAGS
+/* The last flag setting operation, while F (apart from bits 3 and 5) hasn't been
+ * built yet. Bits in mask were since overwritten with the ones in kept. */
+static struct {
+    uint8_t op, old, v, c, result;
+    uint8_t mask, kept;
+    bool pending;
+} lazy;
+
+/* Opcodes that neither read F nor change only part of it, the CB and ED prefixes check their own */
+static const uint8_t cpu_flags_unused[0x100] = {
+        /* 00 */ 1, 1, 1, 1, 0, 0, 1, 0, 0, 0, 1, 1, 0, 0, 1, 0,
+        /* 10 */ 1, 1, 1, 1, 0, 0, 1, 0, 1, 0, 1, 1, 0, 0, 1, 0,
+        /* 20 */ 0, 1, 1, 1, 0, 0, 1, 0, 0, 0, 1, 1, 0, 0, 1, 0,
+        /* 30 */ 0, 1, 1, 1, 0, 0, 1, 0, 0, 0, 1, 1, 0, 0, 1, 0,
+        /* 40 */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        /* 50 */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        /* 60 */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        /* 70 */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        /* 80 */ 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
+        /* 90 */ 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
+        /* A0 */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        /* B0 */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        /* C0 */ 0, 1, 0, 1, 0, 1, 1, 1, 0, 1, 0, 1, 0, 1, 0, 1,
+        /* D0 */ 0, 1, 0, 1, 0, 1, 1, 1, 0, 1, 0, 1, 0, 1, 0, 1,
+        /* E0 */ 0, 1, 0, 1, 0, 1, 1, 1, 0, 1, 0, 1, 0, 1, 1, 1,
+        /* F0 */ 0, 0, 0, 1, 0, 0, 1, 1, 0, 1, 0, 1, 0, 1, 1, 1
+};
+
+static void cpu_flags_sync(void) {
+    if (lazy.pending) {
+        lazy.pending = false;
+        cpu.registers.F = (cpu_alu_flags(lazy.op, lazy.old, lazy.v, lazy.c, lazy.result, 0) & ~lazy.mask)
+            | lazy.kept | cpuflag_undef(cpu.registers.F);
+    }
+}
+#endif
+
+/* Sets F from a flag builder, or records it until F is needed */
+static void cpu_flags_set(int op, uint8_t old, uint8_t v, uint8_t c, uint8_t result, uint8_t kept) {
+#ifdef CPU_LAZY_FLAGS
+    lazy.op = op;
+    lazy.old = old;
+    lazy.v = v;
+    lazy.c = c;
+    lazy.result = result;
+    lazy.mask = 0;
+    lazy.kept = kept;
+    lazy.pending = true;
+#else
+    cpu.registers.F = cpu_alu_flags(op, old, v, c, result, cpuflag_undef(cpu.registers.F) | kept);
+#endif
+}
+
+/* C on its own, without building the rest of F */
+static uint8_t cpu_flags_carry(void) {
+#ifdef CPU_LAZY_FLAGS
+    if (lazy.pending) {
+        switch (lazy.op) {
+            case 0: // ADD A, v
+            case 1: // ADC A, v
+                return cpuflag_carry_b(lazy.old + lazy.v + lazy.c);
+            case 2: // SUB v
+            case 3: // SBC v
+            case 7: // CP v
+                return cpuflag_carry_b(lazy.old - lazy.v - lazy.c);
+            default:
+                return lazy.kept & FLAG_C;
+        }
+    }
+#endif
+    return cpu.registers.flags.C;
+}
+
+/* LDI, LDD and repeats: H and N are reset, P/V is set from pv and the rest is kept */
+static void cpu_flags_ldi(bool pv) {
+#ifdef CPU_LAZY_FLAGS
+    if (lazy.pending) {
+        lazy.mask |= FLAG_H | FLAG_PV | FLAG_N;
+        lazy.kept = (lazy.kept & ~(FLAG_H | FLAG_PV | FLAG_N)) | cpuflag_pv(pv);
+        return;
+    }
+#endif
+    cpu.registers.flags.H = 0;
+    cpu.registers.flags.PV = pv;
+    cpu.registers.flags.N = 0;
+}
+
+/* Idle loop skipping
+ * A loop that only reads memory and ports whose contents can't change before
+ * the next scheduled event is stuck until that event. When a backward branch
+ * arrives at the same target with the same register state as last time, and
+ * nothing in between wrote anything or read an unstable port, the remaining
+ * whole iterations before cpu.next are skipped in one step. Every skipped
+ * iteration would have cost the same cycles, refresh and ram accesses. */
+#ifdef IDLE_SKIP
+static struct {
+    eZ80registers_t registers;  /* register state at the last branch    */
+    uint64_t ram;
+    uint64_t skipped;           /* total cycles skipped                  */
+    uint64_t cycles;
+    uint16_t mode;
+    volatile bool clean;        /* no side effects since the last branch */
+} idle;
+
+static uint16_t cpu_idle_mode(void) {
+    return cpu.NMI | cpu.IEF1 << 1 | cpu.IEF2 << 2 | cpu.ADL << 3 | cpu.MADL << 4 | cpu.IM << 5 |
+           cpu.IEF_wait << 7 | cpu.halted << 9 | cpu.inBlock << 10;
+}
+
+/* Reads of the interrupt controller and the keypad only change in scheduled events,
+ * or in key events and pokes from other threads, which call cpu_idle_invalidate */
+static bool cpu_idle_port(uint16_t pio) {
+    switch (pio >> 12 & 0xF) {
+        case 0x5:
+        case 0xA:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void cpu_idle_mmio(uint32_t address) {
+    uint32_t select = address >> 6 & 0x4000;
+    if (address < (select ? 0xFB0000 : 0xE40000) && !cpu_idle_port(0x1000 + select + (address >> 4 & 0xF000))) {
+        idle.clean = false;
+    }
+}
+
+/* Called after a backward branch was taken */
+static void cpu_idle_branch(void) {
+    uint32_t cost, count;
+    uint8_t R = idle.registers.R;
+
+#ifdef CPU_LAZY_FLAGS
+    cpu_flags_sync();
+#endif
+    if (idle.clean && cpu.registers.PC == idle.registers.PC && cpu.cycles < cpu.next && cpu_idle_mode() == idle.mode) {
+        idle.registers.R = cpu.registers.R;
+        if (!memcmp(&idle.registers, &cpu.registers, sizeof idle.registers)) {
+            cost = cpu.cycles - idle.cycles;
+            count = cost ? (cpu.next - cpu.cycles - 1) / cost : 0;
+            cpu.cycles += count * cost;
+            cpu.registers.R += count * (uint8_t)(cpu.registers.R - R);
+            dma.ram += count * (dma.ram - idle.ram);
+            idle.skipped += (uint64_t)count * cost;
+        }
+    }
+    idle.registers = cpu.registers;
+    idle.ram = dma.ram;
+    idle.cycles = cpu.cycles;
+    idle.mode = cpu_idle_mode();
+    idle.clean = mem.flash.command == NO_COMMAND;
+}
+
+uint64_t cpu_idle_skipped(void) {
+    return idle.skipped;
+}
+
+void cpu_idle_invalidate(void) {
+    idle.clean = false;
+}
+#elif !defined(DEBUG_SUPPORT)
+uint64_t cpu_idle_skipped(void) {
+    return 0;
+}
+
+void cpu_idle_invalidate(void) {
+}
+#endif
+
+static uint8_t cpu_read_mem(uint32_t address, bool fetch) {
+#ifdef IDLE_SKIP
+    if (address >= 0xE00000) {
+        cpu_idle_mmio(address);
+    }
+#endif
+    return mem_read_cpu(address, fetch);
+}
+
+static void cpu_write_mem(uint32_t address, uint8_t value) {
+#ifdef IDLE_SKIP
+    idle.clean = false;
+#endif
+    mem_write_cpu(address, value);
+}
+
+#ifndef DEBUG_SUPPORT
+/* Direct fetch window
+ * Opcode fetches from the 64KB page of mapped flash or ram the PC is in are read
+ * straight from host memory, with the cycles every byte in that page costs.
+ * The window is closed whenever the flash mapping or command state changes. */
+static struct {
+    const uint8_t *ptr;     /* host memory at the start of the window  */
+    uint32_t start;
+    uint32_t size;          /* 0 when the window is closed             */
+    uint16_t cost;
+    uint8_t ram;
+} fetch;
+
+void cpu_fetch_invalidate(void) {
+    fetch.size = 0;
+}
+
+static uint8_t cpu_fetch_mem(uint32_t address) {
+    uint8_t value;
+    uint32_t page;
+
+    if (address - fetch.start < fetch.size) {
+        cpu.cycles += fetch.cost;
+        dma.ram += fetch.ram;
+        return fetch.ptr[address - fetch.start];
+    }
+
+    value = cpu_read_mem(address, true);
+    page = address & ~0xFFFFu;
+    if (address < 0xD00000) {
+        if (address <= flash.mask && flash.mapped && mem.flash.command == NO_COMMAND) {
+            fetch.ptr = mem.flash.block + page;
+            fetch.start = page;
+            fetch.size = 0x10000;
+            fetch.cost = mem_costs()->read[page >> 16];
+            fetch.ram = 0;
+        }
+    } else if (address < 0xE00000 && (page & 0x7FFFF) < ram_size) {
+        fetch.ptr = mem.ram.block + (page & 0x7FFFF);
+        fetch.start = page;
+        fetch.size = ram_size - (page & 0x7FFFF) < 0x10000 ? ram_size - (page & 0x7FFFF) : 0x10000;
+        fetch.cost = mem_costs()->read[page >> 16];
+        fetch.ram = 1;
+    }
+    return value;
+}
+#endif
+
+#ifndef DEBUG_SUPPORT
+/* Predecoded instruction cache
+ * Entries are keyed by PC and ADL (in Z80 mode, MBASE is already part of PC).
+ * Only code in mapped flash and in ram is cached, so the PC is also the
+ * physical location of the code and every byte costs the same to fetch.
+ * On a hit the opcode bytes are replayed instead of read through the memory
+ * handlers, charging the same cycles, and decoding resumes after the prefixes. */
+#define CPU_DECODE_ENTRIES   0x1000
+#define CPU_DECODE_MAX_BYTES 8
+#define CPU_DECODE_VALID     (1u << 31)
+#define CPU_DECODE_STALE     (1u << 30)
+#define CPU_DECODE_NONE      (~0u)
+#define CPU_DECODE_BLOCK     32  /* cached code is tracked per block */
+
+enum { CPU_DECODE_BASE, CPU_DECODE_CB, CPU_DECODE_ED };
+enum { CPU_DECODE_UNCACHED, CPU_DECODE_FLASH, CPU_DECODE_RAM };
+
+typedef struct cpu_decoded {
+    uint32_t tag;
+    uint16_t cost;      /* cycles to fetch each byte                       */
+    uint8_t length;     /* bytes cached, including the next prefetch       */
+    uint8_t skip;       /* bytes fetched before the opcode was dispatched  */
+    uint8_t kind;       /* which opcode table to dispatch to               */
+    uint8_t R;          /* refresh counter increment up to the dispatch    */
+    struct {
+        uint8_t PREFIX : 2;
+        uint8_t SUFFIX : 1;
+        uint8_t L      : 1;
+        uint8_t IL     : 1;
+        uint8_t ram    : 1;
+    };
+    eZ80context_t context;
+    uint8_t bytes[CPU_DECODE_MAX_BYTES];
+    uint8_t strikes;    /* times the code was overwritten after caching    */
+    uint8_t wait;       /* lookups left before recording stale code again  */
+} cpu_decoded_t;
+
+static struct {
+    cpu_decoded_t entries[CPU_DECODE_ENTRIES];
+    uint32_t blocks[0x1000000 / CPU_DECODE_BLOCK / 32]; /* blocks containing cached code */
+    cpu_decoded_t record;           /* instruction being decoded             */
+    const uint8_t *replay;          /* next byte to replay, if any           */
+    uint32_t next;                  /* address of the next sequential fetch  */
+    uint16_t cost;
+    uint8_t ram;
+    uint8_t left;
+    uint8_t R;
+    bool recording;
+} decode;
+
+static void cpu_decode_stop(void) {
+    decode.recording = false;
+    decode.replay = NULL;
+    decode.next = CPU_DECODE_NONE;
+}
+
+void cpu_decode_flush(void) {
+    memset(decode.entries, 0, sizeof decode.entries);
+    memset(decode.blocks, 0, sizeof decode.blocks);
+    cpu_decode_stop();
+    cpu_fetch_invalidate();
+}
+
+static bool cpu_decode_marked(uint32_t address) {
+    uint32_t block = address / CPU_DECODE_BLOCK;
+    return decode.blocks[block >> 5] & 1u << (block & 31);
+}
+
+/* Drops the entries that cached the byte at address. Blocks stay marked,
+ * so writing data next to code only costs a few tag compares. */
+void cpu_decode_invalidate(uint32_t address) {
+    uint32_t start;
+    if (address >= 0xD00000) {
+        address = 0xD00000 | (address & 0x7FFFF);
+    }
+    if (cpu_decode_marked(address)) {
+        for (start = address - (CPU_DECODE_MAX_BYTES - 1); start != address + 1; start++) {
+            cpu_decoded_t *entry = &decode.entries[start & (CPU_DECODE_ENTRIES - 1)];
+            if ((entry->tag & ~(1u << 24)) == (CPU_DECODE_VALID | (start & 0xFFFFFF))) {
+                /* back off from caching code that keeps being modified */
+                entry->tag ^= CPU_DECODE_VALID | CPU_DECODE_STALE;
+                if (entry->strikes < 8) {
+                    entry->strikes++;
+                }
+                entry->wait = (1u << entry->strikes) - 1;
+            }
+        }
+        /* the instruction in flight is only stale if it holds the written byte */
+        if (!cpu.ADL ||
+            (decode.recording && address - (decode.record.tag & 0xFFFFFF) < decode.record.length) ||
+            (decode.replay && address - decode.next < decode.left)) {
+            cpu_decode_stop();
+        }
+    }
+}
+
+void cpu_decode_invalidate_range(uint32_t start, uint32_t end) {
+    for (; start <= end; start++) {
+        if (cpu_decode_marked(start)) {
+            cpu_decode_invalidate(start);
+        } else {
+            start |= CPU_DECODE_BLOCK - 1;
+        }
+    }
+}
+#endif
+
+#ifdef DECODE_CACHE
+static int cpu_decode_region(uint32_t address) {
+    if (address < 0xD00000) {
+        return address <= flash.mask && flash.mapped && mem.flash.command == NO_COMMAND ? CPU_DECODE_FLASH : CPU_DECODE_UNCACHED;
+    }
+    return address < 0xD00000 + ram_size ? CPU_DECODE_RAM : CPU_DECODE_UNCACHED;
+}
+
+static void cpu_decode_mark(uint32_t address) {
+    uint32_t block = address / CPU_DECODE_BLOCK;
+    decode.blocks[block >> 5] |= 1u << (block & 31);
+}
+
+/* Called at the start of an instruction, returns the cached decode if there is one */
+static const cpu_decoded_t *cpu_decode_lookup(void) {
+    uint32_t pc = cpu.registers.PC;
+    cpu_decoded_t *entry = &decode.entries[pc & (CPU_DECODE_ENTRIES - 1)];
+    const uint8_t *ptr;
+
+    if (entry->tag == (CPU_DECODE_VALID | cpu.ADL << 24 | pc) && entry->bytes[0] == cpu.prefetch &&
+        (entry->ram || mem.flash.command == NO_COMMAND)) {
+        /* skip over the fetches done before the dispatch */
+        if (entry->skip) {
+            pc = cpu_address_mode(pc + entry->skip, cpu.ADL);
+            cpu.registers.PC = pc;
+            cpu.registers.rawPC = cpu_mask_mode(pc + 1, cpu.ADL);
+            cpu.prefetch = entry->bytes[entry->skip];
+            cpu.cycles += entry->skip * entry->cost;
+            dma.ram += entry->skip * entry->ram;
+        }
+        decode.recording = false;
+        decode.replay = entry->bytes + entry->skip + 1;
+        decode.cost = entry->cost;
+        decode.ram = entry->ram;
+        decode.left = entry->length - entry->skip - 1;
+        decode.next = decode.left ? cpu_address_mode(pc + 1, cpu.ADL) : CPU_DECODE_NONE;
+        return entry;
+    }
+
+    /* the prefetched byte may be stale if the previous instruction overwrote it */
+    cpu_decode_stop();
+    if (entry->tag == (CPU_DECODE_STALE | cpu.ADL << 24 | pc) && entry->wait) {
+        entry->wait--;
+        return NULL;
+    }
+    if (cpu.L == cpu.ADL && cpu.IL == cpu.ADL && cpu_decode_region(pc) &&
+        (ptr = phys_mem_ptr(pc, 1)) && *ptr == cpu.prefetch) {
+        decode.record.strikes = entry->tag == (CPU_DECODE_STALE | cpu.ADL << 24 | pc) ? entry->strikes : 0;
+        decode.record.tag = CPU_DECODE_VALID | cpu.ADL << 24 | pc;
+        decode.record.ram = cpu_decode_region(pc) == CPU_DECODE_RAM;
+        decode.record.length = 1;
+        decode.record.bytes[0] = cpu.prefetch;
+        decode.record.skip = CPU_DECODE_MAX_BYTES;
+        decode.R = cpu.registers.R;
+        decode.recording = true;
+        decode.next = cpu_address_mode(pc + 1, cpu.ADL);
+        cpu_decode_mark(pc);
+    }
+    return NULL;
+}
+
+/* Sequential fetch while replaying or recording an instruction */
+static void cpu_decode_fetch(void) {
+    uint32_t pc = cpu.registers.PC;
+    uint64_t cycles = cpu.cycles;
+    cpu_decoded_t *record = &decode.record;
+
+    if (decode.replay) {
+        cpu.prefetch = *decode.replay++;
+        cpu.cycles += decode.cost;
+        dma.ram += decode.ram;
+        decode.next = --decode.left ? cpu_address_mode(pc + 1, cpu.ADL) : CPU_DECODE_NONE;
+        return;
+    }
+
+    cpu.prefetch = cpu_fetch_mem(pc);
+    if (record->length == CPU_DECODE_MAX_BYTES || cpu_decode_region(pc) != (record->ram ? CPU_DECODE_RAM : CPU_DECODE_FLASH) ||
+        (record->length > 1 && record->cost != cpu.cycles - cycles)) {
+        cpu_decode_stop();
+        return;
+    }
+    record->cost = cpu.cycles - cycles;
+    record->bytes[record->length++] = cpu.prefetch;
+    decode.next = cpu_address_mode(pc + 1, cpu.ADL);
+    cpu_decode_mark(pc);
+}
+
+/* Remember how the instruction being recorded was decoded */
+static void cpu_decode_dispatch(uint8_t kind, eZ80context_t context) {
+    cpu_decoded_t *record = &decode.record;
+    if (decode.recording) {
+        record->kind = kind;
+        record->context = context;
+        record->skip = record->length - 1;
+        record->R = cpu.registers.R - decode.R;
+        record->PREFIX = cpu.PREFIX;
+        record->SUFFIX = cpu.SUFFIX;
+        record->L = cpu.L;
+        record->IL = cpu.IL;
+    }
+}
+
+static void cpu_decode_commit(void) {
+    if (decode.recording) {
+        if (decode.record.skip < decode.record.length) {
+            decode.entries[decode.record.tag & (CPU_DECODE_ENTRIES - 1)] = decode.record;
+        }
+        cpu_decode_stop();
+    }
+}
+#endif
+
 static void cpu_prefetch(uint32_t address, bool mode) {
     cpu.ADL = mode;
     // rawPC the PC after the next prefetch (which we do late), before adding MBASE.
     cpu.registers.rawPC = cpu_mask_mode(address + 1, mode);
     cpu.registers.PC = cpu_address_mode(address, mode);
-    cpu.prefetch = mem_read_cpu(cpu.registers.PC, true);
+#ifdef DECODE_CACHE
+    if (cpu.registers.PC == decode.next) {
+        cpu_decode_fetch();
+        return;
+    }
+#endif
 #ifdef DEBUG_SUPPORT
-    debugger.data.block[cpu.registers.PC] |= DBG_INST_MARKER;
+    cpu.prefetch = cpu_read_mem(cpu.registers.PC, true);
+    debug_map_set(&debugger.data.markers, cpu.registers.PC, DBG_INST_MARKER);
+#else
+    cpu.prefetch = cpu_fetch_mem(cpu.registers.PC);
 #endif
 }
 static uint8_t cpu_fetch_byte(void) {
     uint8_t value;
 #ifdef DEBUG_SUPPORT
-    if (debugger.data.block[cpu.registers.PC] & (DBG_EXEC_BREAKPOINT | DBG_TEMP_EXEC_BREAKPOINT)) {
-        open_debugger((debugger.data.block[cpu.registers.PC] & DBG_EXEC_BREAKPOINT) ? HIT_EXEC_BREAKPOINT : DBG_STEP, cpu.registers.PC);
+    uint8_t flags = debug_map_get(&debugger.data.block, cpu.registers.PC);
+    if (flags & (DBG_EXEC_BREAKPOINT | DBG_TEMP_EXEC_BREAKPOINT)) {
+        open_debugger((flags & DBG_EXEC_BREAKPOINT) ? HIT_EXEC_BREAKPOINT : DBG_STEP, cpu.registers.PC);
     }
 #endif
     value = cpu.prefetch;
@@ -92,68 +619,98 @@ static uint32_t cpu_fetch_word_no_prefetch(void) {
     return value;
 }
 
-static uint8_t cpu_read_byte(uint32_t address) {
-    uint32_t cpuAddress = cpu_address_mode(address, cpu.L);
+static uint8_t cpu_read_byte_mode(uint32_t address, bool mode) {
+    uint32_t cpuAddress = cpu_address_mode(address, mode);
 #ifdef DEBUG_SUPPORT
     if (cpuAddress == debugger.stepOverInstrEnd) {
-        debugger.data.block[debugger.stepOverInstrEnd = cpu_mask_mode(address + 1, debugger.stepOverMode)] |= DBG_TEMP_EXEC_BREAKPOINT;
+        debugger.stepOverInstrEnd = cpu_mask_mode(address + 1, debugger.stepOverMode);
+        debug_map_set(&debugger.data.block, debugger.stepOverInstrEnd, DBG_TEMP_EXEC_BREAKPOINT);
     }
 #endif
-    return mem_read_cpu(cpuAddress, false);
+    return cpu_read_mem(cpuAddress, false);
 }
-static void cpu_write_byte(uint32_t address, uint8_t value) {
-    uint32_t cpuAddress = cpu_address_mode(address, cpu.L);
-    mem_write_cpu(cpuAddress, value);
+static uint8_t cpu_read_byte(uint32_t address) {
+    return cpu_read_byte_mode(address, cpu.L);
 }
-
-static uint32_t cpu_read_word(uint32_t address) {
-    uint32_t value = cpu_read_byte(address);
-    value |= cpu_read_byte(address + 1) << 8;
-    if (cpu.L) {
-        value |= cpu_read_byte(address + 2) << 16;
-    }
-    return value;
+static void cpu_write_byte_mode(uint32_t address, uint8_t value, bool mode) {
+    cpu_write_mem(cpu_address_mode(address, mode), value);
 }
-static void cpu_write_word(uint32_t address, uint32_t value) {
-    cpu_write_byte(address, value);
-    cpu_write_byte(address + 1, value >> 8);
-    if (cpu.L) {
-        cpu_write_byte(address + 2, value >> 16);
-    }
+static void cpu_write_byte(uint32_t address, uint8_t value) {
+    cpu_write_byte_mode(address, value, cpu.L);
 }
 
 static uint8_t cpu_pop_byte_mode(bool mode) {
-    return mem_read_cpu(cpu_address_mode(cpu.registers.stack[mode].hl++, mode), false);
-}
-static uint8_t cpu_pop_byte(void) {
-    return cpu_pop_byte_mode(cpu.L);
+    return cpu_read_mem(cpu_address_mode(cpu.registers.stack[mode].hl++, mode), false);
 }
 static void cpu_push_byte_mode(uint8_t value, bool mode) {
-    mem_write_cpu(cpu_address_mode(--cpu.registers.stack[mode].hl, mode), value);
+    cpu_write_mem(cpu_address_mode(--cpu.registers.stack[mode].hl, mode), value);
 }
-static void cpu_push_byte(uint8_t value) {
-    cpu_push_byte_mode(value, cpu.L);
+
+/* Word accesses are instantiated for each data mode, so that L is checked
+ * once per word instead of once per byte */
+#define CPU_WORD_ACCESSORS(name, mode)                                      \
+static uint32_t cpu_read_word_##name(uint32_t address) {                    \
+    uint32_t value = cpu_read_byte_mode(address, mode);                     \
+    value |= cpu_read_byte_mode(address + 1, mode) << 8;                    \
+    if (mode) {                                                             \
+        value |= cpu_read_byte_mode(address + 2, mode) << 16;               \
+    }                                                                       \
+    return value;                                                           \
+}                                                                           \
+static void cpu_write_word_##name(uint32_t address, uint32_t value) {       \
+    cpu_write_byte_mode(address, value, mode);                              \
+    cpu_write_byte_mode(address + 1, value >> 8, mode);                     \
+    if (mode) {                                                             \
+        cpu_write_byte_mode(address + 2, value >> 16, mode);                \
+    }                                                                       \
+}                                                                           \
+static void cpu_push_word_##name(uint32_t value) {                          \
+    if (mode) {                                                             \
+        cpu_push_byte_mode(value >> 16, mode);                              \
+    }                                                                       \
+    cpu_push_byte_mode(value >> 8, mode);                                   \
+    cpu_push_byte_mode(value, mode);                                        \
+}                                                                           \
+static uint32_t cpu_pop_word_##name(void) {                                 \
+    uint32_t value = cpu_pop_byte_mode(mode);                               \
+    value |= cpu_pop_byte_mode(mode) << 8;                                  \
+    if (mode) {                                                             \
+        value |= cpu_pop_byte_mode(mode) << 16;                             \
+    }                                                                       \
+    return value;                                                           \
 }
 
-static void cpu_push_word(uint32_t value) {
+CPU_WORD_ACCESSORS(adl, true)
+CPU_WORD_ACCESSORS(z80, false)
+
+static uint32_t cpu_read_word(uint32_t address) {
+    return cpu.L ? cpu_read_word_adl(address) : cpu_read_word_z80(address);
+}
+static void cpu_write_word(uint32_t address, uint32_t value) {
     if (cpu.L) {
-        cpu_push_byte(value >> 16);
+        cpu_write_word_adl(address, value);
+    } else {
+        cpu_write_word_z80(address, value);
     }
-    cpu_push_byte(value >> 8);
-    cpu_push_byte(value);
 }
-
-static uint32_t cpu_pop_word(void) {
-    uint32_t value = cpu_pop_byte();
-    value |= cpu_pop_byte() << 8;
+static void cpu_push_word(uint32_t value) {
     if (cpu.L) {
-        value |= cpu_pop_byte() << 16;
+        cpu_push_word_adl(value);
+    } else {
+        cpu_push_word_z80(value);
     }
-    return value;
+}
+static uint32_t cpu_pop_word(void) {
+    return cpu.L ? cpu_pop_word_adl() : cpu_pop_word_z80();
 }
 
 static uint8_t cpu_read_in(uint16_t pio) {
     cpu.cycles += 2;
+#ifdef IDLE_SKIP
+    if (!cpu_idle_port(pio)) {
+        idle.clean = false;
+    }
+#endif
     if (unprivileged_code())
         return 0; // in returns 0 in unprivileged code
     return port_read_byte(pio);
@@ -161,6 +718,9 @@ static uint8_t cpu_read_in(uint16_t pio) {
 
 static void cpu_write_out(uint16_t pio, uint8_t value) {
     cpu.cycles += 3;
+#ifdef IDLE_SKIP
+    idle.clean = false;
+#endif
     if (unprivileged_code()) {
         control.protectionStatus |= 2;
         gui_console_printf("[CEmu] NMI reset cause by an out instruction in unpriviledged code.\n");
@@ -409,7 +969,7 @@ static void cpu_call(uint32_t address, bool mixed) {
             }
         } else if (cpuEvents & EVENT_DEBUG_STEP_OVER) {
             if (r->PC == debugger.stepOverInstrEnd) {
-                debugger.data.block[debugger.stepOverInstrEnd] &= ~DBG_TEMP_EXEC_BREAKPOINT;
+                debug_map_clear(&debugger.data.block, debugger.stepOverInstrEnd, DBG_TEMP_EXEC_BREAKPOINT);
             }
         }
     }
@@ -476,73 +1036,41 @@ static void cpu_return(void) {
 }
 
 static void cpu_execute_alu(int i, uint8_t v) {
-    uint8_t old;
     eZ80registers_t *r = &cpu.registers;
+    uint8_t old = r->A, c = 0, result;
     switch (i) {
-        case 0: // ADD A, v
-            old = r->A;
-            r->A += v;
-            r->F = cpuflag_sign_b(r->A) | cpuflag_zero(r->A)
-                | cpuflag_undef(r->F) | cpuflag_overflow_b_add(old, v, r->A)
-                | cpuflag_subtract(0) | cpuflag_carry_b(old + v)
-                | cpuflag_halfcarry_b_add(old, v, 0);
-            break;
         case 1: // ADC A, v
-            old = r->A;
-            r->A += v + r->flags.C;
-            r->F = cpuflag_sign_b(r->A) | cpuflag_zero(r->A)
-                | cpuflag_undef(r->F) | cpuflag_overflow_b_add(old, v, r->A)
-                | cpuflag_subtract(0) | cpuflag_carry_b(old + v + r->flags.C)
-                | cpuflag_halfcarry_b_add(old, v, r->flags.C);
-            break;
-        case 2: // SUB v
-            old = r->A;
-            r->A -= v;
-            r->F = cpuflag_sign_b(r->A) | cpuflag_zero(r->A)
-                | cpuflag_undef(r->F) | cpuflag_overflow_b_sub(old, v, r->A)
-                | cpuflag_subtract(1) | cpuflag_carry_b(old - v)
-                | cpuflag_halfcarry_b_sub(old, v, 0);
+            c = r->flags.C;
+            /* fallthrough */
+        case 0: // ADD A, v
+            result = r->A += v + c;
             break;
         case 3: // SBC v
-            old = r->A;
-            r->A -= v + r->flags.C;
-            r->F = cpuflag_sign_b(r->A) | cpuflag_zero(r->A)
-                | cpuflag_undef(r->F) | cpuflag_overflow_b_sub(old, v, r->A)
-                | cpuflag_subtract(1) | cpuflag_carry_b(old - v - r->flags.C)
-                | cpuflag_halfcarry_b_sub(old, v, r->flags.C);
+            c = r->flags.C;
+            /* fallthrough */
+        case 2: // SUB v
+            result = r->A -= v + c;
             break;
         case 4: // AND v
-            r->A &= v;
-            r->F = cpuflag_sign_b(r->A) | cpuflag_zero(r->A)
-                | cpuflag_undef(r->F) | cpuflag_parity(r->A)
-                | FLAG_H;
+            result = r->A &= v;
             break;
         case 5: // XOR v
-            r->A ^= v;
-            r->F = cpuflag_sign_b(r->A) | cpuflag_zero(r->A)
-                | cpuflag_undef(r->F) | cpuflag_parity(r->A);
+            result = r->A ^= v;
             break;
         case 6: // OR v
-            r->A |= v;
-            r->F = cpuflag_sign_b(r->A) | cpuflag_zero(r->A)
-                | cpuflag_undef(r->F) | cpuflag_parity(r->A);
+            result = r->A |= v;
             break;
-        case 7: // CP v
-            old = r->A - v;
-            r->F = cpuflag_sign_b(old) | cpuflag_zero(old)
-                | cpuflag_undef(r->F) | cpuflag_subtract(1)
-                | cpuflag_carry_b(r->A - v)
-                | cpuflag_overflow_b_sub(r->A, v, old)
-                | cpuflag_halfcarry_b_sub(r->A, v, 0);
+        default: // CP v
+            result = old - v;
             break;
     }
+    cpu_flags_set(i, old, v, c, result, 0);
 }
 
 static void cpu_execute_rot(int y, int z, uint32_t address, uint8_t value) {
-    eZ80registers_t *r = &cpu.registers;
     uint8_t old_7 = (value & 0x80) != 0;
     uint8_t old_0 = (value & 0x01) != 0;
-    uint8_t old_c = r->flags.C;
+    uint8_t old_c = cpu_flags_carry();
     uint8_t new_c;
     switch (y) {
         case 0: // RLC value[z]
@@ -585,8 +1113,7 @@ static void cpu_execute_rot(int y, int z, uint32_t address, uint8_t value) {
             abort();
     }
     cpu_write_reg_prefetched(z, address, value);
-    r->F = cpuflag_c(new_c) | cpuflag_sign_b(value) | cpuflag_parity(value)
-        | cpuflag_undef(r->F) | cpuflag_zero(value);
+    cpu_flags_set(CPU_FLAGS_ROT, 0, 0, 0, value, cpuflag_c(new_c));
 }
 
 static void cpu_execute_rot_acc(int y)
@@ -641,6 +1168,107 @@ static void cpu_execute_rot_acc(int y)
     }
 }
 
+#ifdef DEBUG_SUPPORT
+static bool cpu_bli_debug_range(uint32_t start, uint32_t end, uint8_t flags) {
+    for (; start <= end; start++) {
+        if (debug_map_get(&debugger.data.block, start) & flags || start == debugger.stepOverInstrEnd) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+/* Runs as many iterations of an ADL mode LDIR/LDDR as fit before cpu.next in one go,
+ * as long as it only copies plain memory to ram. Returns false if the next iteration
+ * has to go through the normal memory handlers. */
+static bool cpu_execute_ldir_fast(int_fast8_t delta) {
+    uint32_t src = cpu.registers.HL, dst = cpu.registers.DE;
+    uint32_t count, limit, cost, srcLo, srcHi, dstLo, dstHi, i;
+    const uint8_t *from;
+    uint8_t *to;
+    bool ram = true;
+
+    if (!cpu.L) {
+        return false;
+    }
+    count = ((cpu.registers.BC - 1) & 0xFFFFFF) + 1;
+
+    if (src >= 0xD00000 && src < 0xD00000 + ram_size) {
+        from = &mem.ram.block[src - 0xD00000];
+        limit = delta > 0 ? 0xD00000 + ram_size - src : src - 0xD00000 + 1;
+        cost = 4;
+    } else if (src <= flash.mask && flash.mapped && mem.flash.command == NO_COMMAND) {
+        from = &mem.flash.block[src];
+        limit = delta > 0 ? flash.mask + 1 - src : src + 1;
+        cost = mem_costs()->read[src >> 16];
+        ram = false;
+    } else {
+        return false;
+    }
+    if (count > limit) {
+        count = limit;
+    }
+    if (dst < 0xD00000 || dst >= 0xD00000 + ram_size) {
+        return false;
+    }
+    to = &mem.ram.block[dst - 0xD00000];
+    limit = delta > 0 ? 0xD00000 + ram_size - dst : dst - 0xD00000 + 1;
+    if (count > limit) {
+        count = limit;
+    }
+
+    /* read, write and one internal cycle per iteration, stopping once cpu.next is reached */
+    cost += 2 + 1;
+    if (cpu.cycles >= cpu.next) {
+        count = 1;
+    } else if (count > (cpu.next - cpu.cycles + cost - 1) / cost) {
+        count = (cpu.next - cpu.cycles + cost - 1) / cost;
+    }
+
+    srcLo = delta > 0 ? src : src - count + 1;
+    srcHi = srcLo + count - 1;
+    dstLo = delta > 0 ? dst : dst - count + 1;
+    dstHi = dstLo + count - 1;
+    if (unprivileged_code() &&
+        ((srcLo <= control.protectedEnd && srcHi >= control.protectedStart) ||
+         (dstLo <= control.protectedEnd && dstHi >= control.protectedStart))) {
+        return false;
+    }
+    if (control.stackLimit >= dstLo && control.stackLimit <= dstHi) {
+        return false;
+    }
+#ifdef DEBUG_SUPPORT
+    if (cpu_bli_debug_range(srcLo, srcHi, DBG_READ_WATCHPOINT) || cpu_bli_debug_range(dstLo, dstHi, DBG_WRITE_WATCHPOINT)) {
+        return false;
+    }
+    for (i = dstLo; i <= dstHi; i++) {
+        debug_map_clear(&debugger.data.markers, i, DBG_INST_START_MARKER | DBG_INST_MARKER);
+    }
+#endif
+
+#ifdef IDLE_SKIP
+    idle.clean = false;
+#endif
+
+    /* byte by byte, so that overlapping copies repeat like on hardware */
+    for (i = 0; i < count; i++) {
+        *to = *from;
+        to += delta;
+        from += delta;
+    }
+    cpu_decode_invalidate_range(dstLo, dstHi);
+    mem_dirty_range(dstLo, count);
+
+    cpu.cycles += count * cost;
+    dma.ram += count * (ram ? 2 : 1);
+    cpu.registers.HL = (src + count * delta) & 0xFFFFFF;
+    cpu.registers.DE = (dst + count * delta) & 0xFFFFFF;
+    cpu.registers.BC = (cpu.registers.BC - count) & 0xFFFFFF;
+    cpu_flags_ldi(cpu.registers.BC != 0);
+    return true;
+}
+
 static void cpu_execute_bli() {
     eZ80registers_t *r = &cpu.registers;
     uint8_t old, new = 0;
@@ -648,6 +1276,7 @@ static void cpu_execute_bli() {
     uint_fast8_t xp = cpu.context.x << 2 | cpu.context.p;
     int_fast8_t delta = cpu.context.q ? -1 : 1;
     bool repeat = (cpu.context.x | cpu.context.p) & 1;
+    bool pv;
     do {
         switch (cpu.context.z) {
             case 0:
@@ -659,13 +1288,16 @@ static void cpu_execute_bli() {
                         cpu_trap();
                         return;
                 }
+                if (xp == 0xB && cpu_execute_ldir_fast(delta)) {
+                    repeat = r->BC != 0;
+                    continue;
+                }
                 // LDI, LDD, LDIR, LDDR
                 cpu_write_byte(r->DE, cpu_read_byte(r->HL));
                 r->DE = cpu_mask_mode((int32_t)r->DE + delta, cpu.L);
-                r->flags.H = 0;
-                r->flags.PV = cpu_dec_bc_partial_mode() != 0; // Do not mask BC
-                r->flags.N = 0;
-                repeat &= r->flags.PV;
+                pv = cpu_dec_bc_partial_mode() != 0; // Do not mask BC
+                cpu_flags_ldi(pv);
+                repeat &= pv;
                 break;
             case 1:
                 switch (xp) {
@@ -681,12 +1313,9 @@ static void cpu_execute_bli() {
                 // CPI, CPD, CPIR, CPDR
                 old = cpu_read_byte(r->HL);
                 new = r->A - old;
-                r->F = cpuflag_sign_b(new) | cpuflag_zero(new)
-                    | cpuflag_halfcarry_b_sub(r->A, old, 0)
-                    | cpuflag_pv(cpu_dec_bc_partial_mode()) // Do not mask BC
-                    | cpuflag_subtract(1) | cpuflag_c(r->flags.C)
-                    | cpuflag_undef(r->F);
-                repeat &= !r->flags.Z && r->flags.PV;
+                pv = cpu_dec_bc_partial_mode() != 0; // Do not mask BC
+                cpu_flags_set(CPU_FLAGS_CPI, r->A, old, 0, new, cpuflag_pv(pv) | cpuflag_c(cpu_flags_carry()));
+                repeat &= new && pv;
                 if (!repeat) {
                     internalCycles--;
                 }
@@ -795,19 +1424,26 @@ static void cpu_execute_bli() {
 
 }
 
+#ifndef CPU_LEAN
 void cpu_init(void) {
     memset(&cpu, 0, sizeof(eZ80cpu_t));
+    cpu_decode_flush();
     gui_console_printf("[CEmu] Initialized CPU...\n");
 }
 
 void cpu_reset(void) {
     memset(&cpu.registers, 0, sizeof(eZ80registers_t));
-    cpu.IEF1 = cpu.IEF2 = cpu.ADL = cpu.MADL = cpu.IM = cpu.IEF_wait = cpu.halted = cpu.cycles = cpu.next = 0;
+#ifdef CPU_LAZY_FLAGS
+    lazy.pending = false;
+#endif
+    cpu.IEF1 = cpu.IEF2 = cpu.ADL = cpu.MADL = cpu.IM = cpu.IEF_wait = cpu.halted = 0;
+    cpu.next = cpu.cycles;
     cpu_flush(0, 0);
     gui_console_printf("[CEmu] CPU reset.\n");
 }
 
 void cpu_flush(uint32_t address, bool mode) {
+    cpu_decode_flush();
     cpu_prefetch(address, mode);
     cpu_clear_mode();
     cpu.inBlock = 0;
@@ -823,7 +1459,15 @@ void cpu_nmi(void) {
 #endif
 }
 
+#endif
+
+#ifdef CPU_LEAN
+void cpu_execute_lean(void) {
+#elif defined(DEBUG_SUPPORT)
+static void cpu_execute_debug(void) {
+#else
 void cpu_execute(void) {
+#endif
     /* variable declarations */
     int8_t s;
     int32_t sw;
@@ -840,10 +1484,86 @@ void cpu_execute(void) {
     eZ80registers_t *r = &cpu.registers;
     eZ80context_t context;
 
-    uint32_t save_next = cpu.next;
+    uint64_t save_next = cpu.next;
+
+#ifdef CPU_THREADED
+    /* DD/FD and DDCB/FDCB share these through cpu.PREFIX */
+    static const void *const base_ops[0x100] = {
+        /* 00 */ &&op_nop, &&op_ld_rp_nn, &&op_ld_bc_a, &&op_inc_rp, &&op_inc_r, &&op_dec_r, &&op_ld_r_n, &&op_ld_ind_rot,
+        /* 08 */ &&op_ex_af, &&op_add_hl_rp, &&op_ld_a_bc, &&op_dec_rp, &&op_inc_r, &&op_dec_r, &&op_ld_r_n, &&op_ld_ind_rot,
+        /* 10 */ &&op_djnz, &&op_ld_rp_nn, &&op_ld_de_a, &&op_inc_rp, &&op_inc_r, &&op_dec_r, &&op_ld_r_n, &&op_ld_ind_rot,
+        /* 18 */ &&op_jr, &&op_add_hl_rp, &&op_ld_a_de, &&op_dec_rp, &&op_inc_r, &&op_dec_r, &&op_ld_r_n, &&op_ld_ind_rot,
+        /* 20 */ &&op_jr_cc, &&op_ld_rp_nn, &&op_ld_nn_hl, &&op_inc_rp, &&op_inc_r, &&op_dec_r, &&op_ld_r_n, &&op_ld_ind_rot,
+        /* 28 */ &&op_jr_cc, &&op_add_hl_rp, &&op_ld_hl_nn, &&op_dec_rp, &&op_inc_r, &&op_dec_r, &&op_ld_r_n, &&op_ld_ind_rot,
+        /* 30 */ &&op_jr_cc, &&op_ld_rp_nn, &&op_ld_nn_a, &&op_inc_rp, &&op_inc_r, &&op_dec_r, &&op_ld_r_n, &&op_ld_ind_rot,
+        /* 38 */ &&op_jr_cc, &&op_add_hl_rp, &&op_ld_a_nn, &&op_dec_rp, &&op_inc_r, &&op_dec_r, &&op_ld_r_n, &&op_ld_ind_rot,
+        /* 40 */ &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r,
+        /* 48 */ &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r,
+        /* 50 */ &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r,
+        /* 58 */ &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r,
+        /* 60 */ &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r,
+        /* 68 */ &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r,
+        /* 70 */ &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r,
+        /* 78 */ &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r, &&op_ld_r_r,
+        /* 80 */ &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r,
+        /* 88 */ &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r,
+        /* 90 */ &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r,
+        /* 98 */ &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r,
+        /* A0 */ &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r,
+        /* A8 */ &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r,
+        /* B0 */ &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r,
+        /* B8 */ &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r, &&op_alu_r,
+        /* C0 */ &&op_ret_cc, &&op_pop, &&op_jp_cc, &&op_jp, &&op_call_cc, &&op_push, &&op_alu_n, &&op_rst,
+        /* C8 */ &&op_ret_cc, &&op_ret, &&op_jp_cc, &&op_cb, &&op_call_cc, &&op_call, &&op_alu_n, &&op_rst,
+        /* D0 */ &&op_ret_cc, &&op_pop, &&op_jp_cc, &&op_out_n, &&op_call_cc, &&op_push, &&op_alu_n, &&op_rst,
+        /* D8 */ &&op_ret_cc, &&op_exx, &&op_jp_cc, &&op_in_n, &&op_call_cc, &&op_dd, &&op_alu_n, &&op_rst,
+        /* E0 */ &&op_ret_cc, &&op_pop, &&op_jp_cc, &&op_ex_sp_hl, &&op_call_cc, &&op_push, &&op_alu_n, &&op_rst,
+        /* E8 */ &&op_ret_cc, &&op_jp_rr, &&op_jp_cc, &&op_ex_de_hl, &&op_call_cc, &&op_ed, &&op_alu_n, &&op_rst,
+        /* F0 */ &&op_ret_cc, &&op_pop, &&op_jp_cc, &&op_di, &&op_call_cc, &&op_push, &&op_alu_n, &&op_rst,
+        /* F8 */ &&op_ret_cc, &&op_ld_sp_hl, &&op_jp_cc, &&op_ei, &&op_call_cc, &&op_fd, &&op_alu_n, &&op_rst
+    };
+    static const void *const ed_ops[0x100] = {
+        /* 00 */ &&op_ed_in0, &&op_ed_out0, &&op_ed_lea, &&op_ed_lea, &&op_ed_tst_r, &&op_ed_trap, &&op_ed_ld_hl_iy, &&op_ed_ld_rp3_hl,
+        /* 08 */ &&op_ed_in0, &&op_ed_out0, &&op_ed_lea, &&op_ed_lea, &&op_ed_tst_r, &&op_ed_trap, &&op_ed_ld_hl_iy, &&op_ed_ld_rp3_hl,
+        /* 10 */ &&op_ed_in0, &&op_ed_out0, &&op_ed_lea, &&op_ed_lea, &&op_ed_tst_r, &&op_ed_trap, &&op_ed_ld_hl_iy, &&op_ed_ld_rp3_hl,
+        /* 18 */ &&op_ed_in0, &&op_ed_out0, &&op_ed_lea, &&op_ed_lea, &&op_ed_tst_r, &&op_ed_trap, &&op_ed_ld_hl_iy, &&op_ed_ld_rp3_hl,
+        /* 20 */ &&op_ed_in0, &&op_ed_out0, &&op_ed_lea, &&op_ed_lea, &&op_ed_tst_r, &&op_ed_trap, &&op_ed_ld_hl_iy, &&op_ed_ld_rp3_hl,
+        /* 28 */ &&op_ed_in0, &&op_ed_out0, &&op_ed_lea, &&op_ed_lea, &&op_ed_tst_r, &&op_ed_trap, &&op_ed_ld_hl_iy, &&op_ed_ld_rp3_hl,
+        /* 30 */ &&op_ed_in0, &&op_ed_out0, &&op_ed_lea, &&op_ed_lea, &&op_ed_tst_r, &&op_ed_trap, &&op_ed_ld_hl_iy, &&op_ed_ld_rp3_hl,
+        /* 38 */ &&op_ed_in0, &&op_ed_out0, &&op_ed_lea, &&op_ed_lea, &&op_ed_tst_r, &&op_ed_trap, &&op_ed_ld_hl_iy, &&op_ed_ld_rp3_hl,
+        /* 40 */ &&op_ed_in_bc, &&op_ed_out_bc, &&op_ed_sbc_adc, &&op_ed_ld_nn_rp, &&op_ed_neg, &&op_ed_reti, &&op_ed_im, &&op_ed_ld_i_a,
+        /* 48 */ &&op_ed_in_bc, &&op_ed_out_bc, &&op_ed_sbc_adc, &&op_ed_ld_nn_rp, &&op_ed_mlt, &&op_ed_reti, &&op_ed_trap, &&op_ed_ld_r_a,
+        /* 50 */ &&op_ed_in_bc, &&op_ed_out_bc, &&op_ed_sbc_adc, &&op_ed_ld_nn_rp, &&op_ed_lea_ix_iy, &&op_ed_lea_iy_ix, &&op_ed_im, &&op_ed_ld_a_i,
+        /* 58 */ &&op_ed_in_bc, &&op_ed_out_bc, &&op_ed_sbc_adc, &&op_ed_ld_nn_rp, &&op_ed_mlt, &&op_ed_trap, &&op_ed_im, &&op_ed_ld_a_r,
+        /* 60 */ &&op_ed_in_bc, &&op_ed_out_bc, &&op_ed_sbc_adc, &&op_ed_ld_nn_rp, &&op_ed_tst_n, &&op_ed_pea_ix, &&op_ed_pea_iy, &&op_ed_rrd,
+        /* 68 */ &&op_ed_in_bc, &&op_ed_out_bc, &&op_ed_sbc_adc, &&op_ed_ld_nn_rp, &&op_ed_mlt, &&op_ed_ld_mb_a, &&op_ed_ld_a_mb, &&op_ed_rld,
+        /* 70 */ &&op_ed_in_bc, &&op_ed_out_bc, &&op_ed_sbc_adc, &&op_ed_ld_nn_rp, &&op_ed_tstio, &&op_ed_trap, &&op_ed_slp, &&op_ed_trap,
+        /* 78 */ &&op_ed_in_bc, &&op_ed_out_bc, &&op_ed_sbc_adc, &&op_ed_ld_nn_rp, &&op_ed_mlt, &&op_ed_stmix, &&op_ed_rsmix, &&op_ed_trap,
+        /* 80 */ &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli,
+        /* 88 */ &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli,
+        /* 90 */ &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli,
+        /* 98 */ &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli,
+        /* A0 */ &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli,
+        /* A8 */ &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli,
+        /* B0 */ &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli,
+        /* B8 */ &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli, &&op_ed_bli,
+        /* C0 */ &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3,
+        /* C8 */ &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3,
+        /* D0 */ &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3,
+        /* D8 */ &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3,
+        /* E0 */ &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3,
+        /* E8 */ &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3,
+        /* F0 */ &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3,
+        /* F8 */ &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3, &&op_ed_x3
+    };
+#endif
 
     while (!exiting) {
     cpu_execute_continue:
+#ifdef IDLE_SKIP
+        /* scheduled events may have changed what the loop is waiting on */
+        idle.clean = false;
+#endif
         if (cpu.IEF_wait) {
             if (cpu.IEF_wait > 1) {
                 if (cpu.cycles < cpu.next) {
@@ -864,7 +1584,10 @@ void cpu_execute(void) {
             if (cpu.NMI) {
                 cpu.NMI = 0;
                 cpu_call(0x66, cpu.MADL);
-                cpu.next = save_next;
+                /* an nmi raised by the push itself stops here too, like any other */
+                if (!cpu.NMI) {
+                    cpu.next = save_next;
+                }
             } else if (cpu.IM != 3) {
                 cpu_call(0x38, cpu.MADL);
             } else {
@@ -877,7 +1600,6 @@ void cpu_execute(void) {
             }
 #endif
         } else if (cpu.halted && cpu.cycles < cpu.next) {
-            cpu.cycles_offset -= cpu.next - cpu.cycles;
             cpu.cycles = cpu.next; // consume all of the cycles
         }
         if (exiting || cpu.cycles >= cpu.next) {
@@ -887,22 +1609,61 @@ void cpu_execute(void) {
             goto cpu_execute_bli_continue;
         }
         do {
+#ifdef DECODE_CACHE
+            if (!cpu.PREFIX && !cpu.SUFFIX) {
+                const cpu_decoded_t *entry = cpu_decode_lookup();
+                if (entry) {
+                    cpu.PREFIX = entry->PREFIX;
+                    cpu.SUFFIX = entry->SUFFIX;
+                    cpu.L = entry->L;
+                    cpu.IL = entry->IL;
+                    r->R += entry->R;
+                    context = entry->context;
+                    if (entry->kind == CPU_DECODE_ED) {
+                        goto cpu_execute_ed;
+                    } else if (entry->kind == CPU_DECODE_CB) {
+                        w = cpu_read_index();
+                        if (cpu.PREFIX) {
+                            w += (int8_t)entry->bytes[entry->skip - 2];
+                        }
+                        w = cpu_mask_mode(w, cpu.L);
+                        goto cpu_execute_cb;
+                    }
+                    goto cpu_execute_base;
+                }
+            }
+#endif
             // fetch opcode
             context.opcode = cpu_fetch_byte();
             r->R += 2;
+#ifdef DECODE_CACHE
+            cpu_decode_dispatch(CPU_DECODE_BASE, context);
+        cpu_execute_base:
+#endif
+#ifdef CPU_LAZY_FLAGS
+            if (!cpu_flags_unused[context.opcode]) {
+                cpu_flags_sync();
+            }
+#endif
+#ifdef CPU_THREADED
+            goto *base_ops[context.opcode];
+#endif
             switch (context.x) {
                 case 0:
                     switch (context.z) {
                         case 0:
                             switch (context.y) {
                                 case 0:  // NOP
+                                    CPU_OP(nop)
                                     break;
                                 case 1:  // EX af,af'
+                                    CPU_OP(ex_af)
                                     w = r->AF;
                                     r->AF = r->_AF;
                                     r->_AF = w;
                                     break;
                                 case 2: // DJNZ d
+                                    CPU_OP(djnz)
                                     s = cpu_fetch_offset();
                                     if (--r->B) {
                                         cpu.cycles++;
@@ -910,17 +1671,29 @@ void cpu_execute(void) {
                                     }
                                     break;
                                 case 3: // JR d
+                                    CPU_OP(jr)
                                     s = cpu_fetch_offset();
                                     cpu_prefetch(cpu_mask_mode((int32_t)r->PC + s, cpu.L), cpu.ADL);
+#ifdef IDLE_SKIP
+                                    if (s < 0) {
+                                        cpu_idle_branch();
+                                    }
+#endif
                                     break;
                                 case 4:
                                 case 5:
                                 case 6:
                                 case 7: // JR cc[y-4], d
+                                    CPU_OP(jr_cc)
                                     s = cpu_fetch_offset();
                                     if (cpu_read_cc(context.y - 4)) {
                                         cpu.cycles++;
                                         cpu_prefetch(cpu_mask_mode((int32_t)r->PC + s, cpu.L), cpu.ADL);
+#ifdef IDLE_SKIP
+                                        if (s < 0) {
+                                            cpu_idle_branch();
+                                        }
+#endif
                                     }
                                     break;
                             }
@@ -928,6 +1701,7 @@ void cpu_execute(void) {
                         case 1:
                             switch (context.q) {
                                 case 0: // LD rr, Mmn
+                                    CPU_OP(ld_rp_nn)
                                     if (context.p == 3 && cpu.PREFIX) { // LD IY/IX, (IX/IY + d)
                                         cpu_write_other_index(cpu_read_word(cpu_index_address()));
                                         break;
@@ -935,6 +1709,7 @@ void cpu_execute(void) {
                                     cpu_write_rp(context.p, cpu_fetch_word());
                                     break;
                                 case 1: // ADD HL,rr
+                                    CPU_OP(add_hl_rp)
                                     old_word = cpu_mask_mode(cpu_read_index(), cpu.L);
                                     op_word = cpu_mask_mode(cpu_read_rp(context.p), cpu.L);
                                     new_word = old_word + op_word;
@@ -951,15 +1726,19 @@ void cpu_execute(void) {
                                 case 0:
                                     switch (context.p) {
                                         case 0: // LD (BC), A
+                                            CPU_OP(ld_bc_a)
                                             cpu_write_byte(r->BC, r->A);
                                             break;
                                         case 1: // LD (DE), A
+                                            CPU_OP(ld_de_a)
                                             cpu_write_byte(r->DE, r->A);
                                             break;
                                         case 2: // LD (Mmn), HL
+                                            CPU_OP(ld_nn_hl)
                                             cpu_write_word(cpu_fetch_word(), cpu_read_index());
                                             break;
                                         case 3: // LD (Mmn), A
+                                            CPU_OP(ld_nn_a)
                                             cpu_write_byte(cpu_fetch_word(), r->A);
                                             break;
                                     }
@@ -967,15 +1746,19 @@ void cpu_execute(void) {
                                 case 1:
                                     switch (context.p) {
                                         case 0: // LD A, (BC)
+                                            CPU_OP(ld_a_bc)
                                             r->A = cpu_read_byte(r->BC);
                                             break;
                                         case 1: // LD A, (DE)
+                                            CPU_OP(ld_a_de)
                                             r->A = cpu_read_byte(r->DE);
                                             break;
                                         case 2: // LD HL, (Mmn)
+                                            CPU_OP(ld_hl_nn)
                                             cpu_write_index(cpu_read_word(cpu_fetch_word()));
                                             break;
                                         case 3: // LD A, (Mmn)
+                                            CPU_OP(ld_a_nn)
                                             r->A = cpu_read_byte(cpu_fetch_word());
                                             break;
                                     }
@@ -985,14 +1768,17 @@ void cpu_execute(void) {
                         case 3:
                             switch (context.q) {
                                 case 0: // INC rp[p]
+                                    CPU_OP(inc_rp)
                                     cpu_write_rp(context.p, (int32_t)cpu_read_rp(context.p) + 1);
                                     break;
                                 case 1: // DEC rp[p]
+                                    CPU_OP(dec_rp)
                                     cpu_write_rp(context.p, (int32_t)cpu_read_rp(context.p) - 1);
                                     break;
                             }
                             break;
                         case 4: // INC r[y]
+                            CPU_OP(inc_r)
                             w = (context.y == 6) ? cpu_index_address() : 0;
                             old = cpu_read_reg_prefetched(context.y, w);
                             new = old + 1;
@@ -1002,6 +1788,7 @@ void cpu_execute(void) {
                                 | cpuflag_subtract(0) | cpuflag_undef(r->F);
                             break;
                         case 5: // DEC r[y]
+                            CPU_OP(dec_r)
                             w = (context.y == 6) ? cpu_index_address() : 0;
                             old = cpu_read_reg_prefetched(context.y, w);
                             new = old - 1;
@@ -1011,6 +1798,7 @@ void cpu_execute(void) {
                                 | cpuflag_subtract(1) | cpuflag_undef(r->F);
                             break;
                         case 6: // LD r[y], n
+                            CPU_OP(ld_r_n)
                             if (context.y == 7 && cpu.PREFIX) { // LD (IX/IY + d), IY/IX
                                 cpu_write_word(cpu_index_address(), cpu_read_other_index());
                                 break;
@@ -1019,6 +1807,7 @@ void cpu_execute(void) {
                             cpu_write_reg_prefetched(context.y, w, cpu_fetch_byte());
                             break;
                         case 7:
+                            CPU_OP(ld_ind_rot)
                             if (cpu.PREFIX) {
                                 if (context.q) { // LD (IX/IY + d), rp3[p]
                                     cpu_write_word(cpu_index_address(), cpu_read_rp3(context.p));
@@ -1032,6 +1821,7 @@ void cpu_execute(void) {
                     }
                     break;
                 case 1: // ignore prefixed prefixes
+                    CPU_OP(ld_r_r)
                     if (context.z == context.y) {
                         switch (context.z) {
                             case 0: // .SIS
@@ -1068,11 +1858,13 @@ void cpu_execute(void) {
                     }
                     break;
                 case 2: // ALU[y] r[z]
+                    CPU_OP(alu_r)
                     cpu_execute_alu(context.y, cpu_read_reg(context.z));
                     break;
                 case 3:
                     switch (context.z) {
                         case 0: // RET cc[y]
+                            CPU_OP(ret_cc)
                             cpu.cycles++;
                             if (cpu_read_cc(context.y)) {
                                 cpu_return();
@@ -1081,14 +1873,17 @@ void cpu_execute(void) {
                         case 1:
                             switch (context.q) {
                                 case 0: // POP rp2[p]
+                                    CPU_OP(pop)
                                     cpu_write_rp2(context.p, cpu_pop_word());
                                     break;
                                 case 1:
                                     switch (context.p) {
                                         case 0: // RET
+                                            CPU_OP(ret)
                                             cpu_return();
                                             break;
                                         case 1: // EXX
+                                            CPU_OP(exx)
                                             w = r->BC;
                                             r->BC = r->_BC;
                                             r->_BC = w;
@@ -1100,11 +1895,13 @@ void cpu_execute(void) {
                                             r->_HL = w;
                                             break;
                                         case 2: // JP (rr)
+                                            CPU_OP(jp_rr)
                                             cpu_prefetch_next();
                                             cpu_prefetch(cpu_read_index(), cpu.L);
                                             cpu_check_step_out();
                                             break;
                                         case 3: // LD SP, HL
+                                            CPU_OP(ld_sp_hl)
                                             cpu_write_sp(cpu_read_index());
                                             break;
                                     }
@@ -1112,9 +1909,16 @@ void cpu_execute(void) {
                             }
                             break;
                         case 2: // JP cc[y], nn
+                            CPU_OP(jp_cc)
                             if (cpu_read_cc(context.y)) {
                                 cpu.cycles++;
+                                w = r->PC;
                                 cpu_prefetch(cpu_fetch_word_no_prefetch(), cpu.L);
+#ifdef IDLE_SKIP
+                                if (r->PC <= w) {
+                                    cpu_idle_branch();
+                                }
+#endif
                             } else {
                                 cpu_fetch_word();
                             }
@@ -1122,13 +1926,25 @@ void cpu_execute(void) {
                         case 3:
                             switch (context.y) {
                                 case 0: // JP nn
+                                    CPU_OP(jp)
                                     cpu.cycles++;
+                                    w = r->PC;
                                     cpu_prefetch(cpu_fetch_word_no_prefetch(), cpu.L);
+#ifdef IDLE_SKIP
+                                    if (r->PC <= w) {
+                                        cpu_idle_branch();
+                                    }
+#endif
                                     break;
                                 case 1: // 0xCB prefixed opcodes
+                                    CPU_OP(cb)
                                     w = cpu_index_address();
                                     context.opcode = cpu_fetch_byte();
                                     r->R += ~cpu.PREFIX & 2;
+#ifdef DECODE_CACHE
+                                    cpu_decode_dispatch(CPU_DECODE_CB, context);
+                                cpu_execute_cb:
+#endif
                                     if (cpu.PREFIX && context.z != 6) { // OPCODETRAP
                                         cpu_trap_rewind(2);
                                     } else {
@@ -1138,6 +1954,9 @@ void cpu_execute(void) {
                                                 cpu_execute_rot(context.y, context.z, w, old);
                                                 break;
                                             case 1: // BIT y, r[z]
+#ifdef CPU_LAZY_FLAGS
+                                                cpu_flags_sync();
+#endif
                                                 old &= (1 << context.y);
                                                 r->F = cpuflag_sign_b(old) | cpuflag_zero(old) | cpuflag_undef(r->F)
                                                     | cpuflag_parity(old) | cpuflag_c(r->flags.C)
@@ -1157,12 +1976,15 @@ void cpu_execute(void) {
                                     }
                                     break;
                                 case 2: // OUT (n), A
+                                    CPU_OP(out_n)
                                     cpu_write_out((r->A << 8) | cpu_fetch_byte(), r->A);
                                     break;
                                 case 3: // IN A, (n)
+                                    CPU_OP(in_n)
                                     r->A = cpu_read_in((r->A << 8) | cpu_fetch_byte());
                                     break;
                                 case 4: // EX (SP), HL/I
+                                    CPU_OP(ex_sp_hl)
                                     w = cpu_read_sp();
                                     old_word = cpu_read_word(w);
                                     new_word = cpu_read_index();
@@ -1170,14 +1992,17 @@ void cpu_execute(void) {
                                     cpu_write_word(w, new_word);
                                     break;
                                 case 5: // EX DE, HL
+                                    CPU_OP(ex_de_hl)
                                     w = cpu_mask_mode(r->DE, cpu.L);
                                     r->DE = cpu_mask_mode(r->HL, cpu.L);
                                     r->HL = w;
                                     break;
                                 case 6: // DI
+                                    CPU_OP(di)
                                     cpu.IEF_wait = cpu.IEF1 = cpu.IEF2 = 0;
                                     break;
                                 case 7: // EI
+                                    CPU_OP(ei)
                                     if (cpu.cycles < cpu.next) {
                                         cpu.IEF_wait = 1;
                                         save_next = cpu.next;
@@ -1189,6 +2014,7 @@ void cpu_execute(void) {
                             }
                             break;
                         case 4: // CALL cc[y], nn
+                            CPU_OP(call_cc)
                             if (cpu_read_cc(context.y)) {
                                 cpu_call(cpu_fetch_word_no_prefetch(), cpu.SUFFIX);
 #ifdef DEBUG_SUPPORT
@@ -1201,27 +2027,45 @@ void cpu_execute(void) {
                         case 5:
                             switch (context.q) {
                                 case 0: // PUSH r2p[p]
+                                    CPU_OP(push)
                                     cpu_push_word(cpu_read_rp2(context.p));
                                     break;
                                 case 1:
                                     switch (context.p) {
                                         case 0: // CALL nn
+                                            CPU_OP(call)
                                             cpu_call(cpu_fetch_word_no_prefetch(), cpu.SUFFIX);
 #ifdef DEBUG_SUPPORT
                                             debug_switch_step_mode();
 #endif
                                             break;
                                         case 1: // 0xDD prefixed opcodes
+                                            CPU_OP(dd)
                                             cpu.PREFIX = 2;
                                             continue;
                                         case 2: // 0xED prefixed opcodes
+                                            CPU_OP(ed)
                                             cpu.PREFIX = 0; // ED cancels effect of DD/FD prefix
                                             context.opcode = cpu_fetch_byte();
                                             r->R += 2;
+#ifdef DECODE_CACHE
+                                            cpu_decode_dispatch(CPU_DECODE_ED, context);
+                                        cpu_execute_ed:
+#endif
+#ifdef CPU_LAZY_FLAGS
+                                            /* only LDI, LDD, CPI, CPD and their repeats leave F pending */
+                                            if ((context.opcode & 0xE6) != 0xA0) {
+                                                cpu_flags_sync();
+                                            }
+#endif
+#ifdef CPU_THREADED
+                                            goto *ed_ops[context.opcode];
+#endif
                                             switch (context.x) {
                                                 case 0:
                                                     switch (context.z) {
                                                         case 0: // IN0 r[y], (n)
+                                                            CPU_OP(ed_in0)
                                                             new = cpu_read_in(cpu_fetch_byte());
                                                             if (context.y != 6) {
                                                                 cpu_write_reg(context.y, new);
@@ -1231,6 +2075,7 @@ void cpu_execute(void) {
                                                                 | cpuflag_c(r->flags.C);
                                                             break;
                                                          case 1:
+                                                             CPU_OP(ed_out0)
                                                             if (context.y == 6) { // LD IY, (HL)
                                                                 r->IY = cpu_read_word(r->HL);
                                                             } else { // OUT0 (n), r[y]
@@ -1239,6 +2084,7 @@ void cpu_execute(void) {
                                                             break;
                                                         case 2: // LEA rp3[p], IX
                                                         case 3: // LEA rp3[p], IY
+                                                            CPU_OP(ed_lea)
                                                             if (context.q) { // OPCODETRAP
                                                                 cpu_trap();
                                                             } else {
@@ -1247,20 +2093,24 @@ void cpu_execute(void) {
                                                             }
                                                             break;
                                                         case 4: // TST A, r[y]
+                                                            CPU_OP(ed_tst_r)
                                                             new = r->A & cpu_read_reg(context.y);
                                                             r->F = cpuflag_sign_b(new) | cpuflag_zero(new)
                                                                 | cpuflag_undef(r->F) | cpuflag_parity(new)
                                                                 | FLAG_H;
                                                             break;
                                                         case 6:
+                                                            CPU_OP(ed_ld_hl_iy)
                                                             if (context.y == 7) { // LD (HL), IY
                                                                 cpu_write_word(r->HL, r->IY);
                                                                 break;
                                                             }
                                                         case 5: // OPCODETRAP
+                                                            CPU_OP(ed_trap)
                                                             cpu_trap();
                                                             break;
                                                         case 7:
+                                                            CPU_OP(ed_ld_rp3_hl)
                                                             cpu.PREFIX = 2;
                                                             if (context.q) { // LD (HL), rp3[p]
                                                                 cpu_write_word(r->HL, cpu_read_rp3(context.p));
@@ -1273,6 +2123,7 @@ void cpu_execute(void) {
                                                 case 1:
                                                     switch (context.z) {
                                                         case 0: // IN r[y], (BC)
+                                                            CPU_OP(ed_in_bc)
                                                             new = cpu_read_in(r->BC);
                                                             if (context.y != 6) {
                                                                 cpu_write_reg(context.y, new);
@@ -1282,6 +2133,7 @@ void cpu_execute(void) {
                                                                 | cpuflag_c(r->flags.C);
                                                             break;
                                                         case 1:
+                                                            CPU_OP(ed_out_bc)
                                                             if (context.y == 6) { // OPCODETRAP (ADL)
                                                                 cpu_trap();
                                                             } else { // OUT (BC), r[y]
@@ -1289,6 +2141,7 @@ void cpu_execute(void) {
                                                             }
                                                             break;
                                                         case 2:
+                                                            CPU_OP(ed_sbc_adc)
                                                             old_word = cpu_mask_mode(r->HL, cpu.L);
                                                             op_word = cpu_mask_mode(cpu_read_rp(context.p), cpu.L);
                                                             if (context.q == 0) { // SBC HL, rp[p]
@@ -1306,6 +2159,7 @@ void cpu_execute(void) {
                                                             }
                                                             break;
                                                         case 3:
+                                                            CPU_OP(ed_ld_nn_rp)
                                                             if (context.q == 0) { // LD (nn), rp[p]
                                                                 cpu_write_word(cpu_fetch_word(), cpu_read_rp(context.p));
                                                             } else { // LD rp[p], (nn)
@@ -1316,6 +2170,7 @@ void cpu_execute(void) {
                                                             if (context.q == 0) {
                                                                 switch (context.p) {
                                                                     case 0:  // NEG
+                                                                        CPU_OP(ed_neg)
                                                                         old = r->A;
                                                                         r->A = -r->A;
                                                                         r->F = cpuflag_sign_b(r->A) | cpuflag_zero(r->A)
@@ -1324,16 +2179,19 @@ void cpu_execute(void) {
                                                                             | cpuflag_halfcarry_b_sub(0, old, 0);
                                                                         break;
                                                                     case 1:  // LEA IX, IY + d
+                                                                        CPU_OP(ed_lea_ix_iy)
                                                                         cpu.PREFIX = 3;
                                                                         r->IX = cpu_index_address();
                                                                         break;
                                                                     case 2:  // TST A, n
+                                                                        CPU_OP(ed_tst_n)
                                                                         new = r->A & cpu_fetch_byte();
                                                                         r->F = cpuflag_sign_b(new) | cpuflag_zero(new)
                                                                             | cpuflag_undef(r->F) | cpuflag_parity(new)
                                                                             | FLAG_H;
                                                                         break;
                                                                     case 3:  // TSTIO n
+                                                                        CPU_OP(ed_tstio)
                                                                         new = cpu_read_in(r->C) & cpu_fetch_byte();
                                                                         r->F = cpuflag_sign_b(new) | cpuflag_zero(new)
                                                                             | cpuflag_undef(r->F) | cpuflag_parity(new)
@@ -1342,6 +2200,7 @@ void cpu_execute(void) {
                                                                 }
                                                             }
                                                             else { // MLT rp[p]
+                                                                CPU_OP(ed_mlt)
                                                                 cpu.cycles += 4;
                                                                 old_word = cpu_read_rp(context.p);
                                                                 new_word = (old_word&0xFF) * ((old_word>>8)&0xFF);
@@ -1354,10 +2213,12 @@ void cpu_execute(void) {
                                                                 case 0: // RETN
                                                                     // This is actually identical to reti on the z80
                                                                 case 1: // RETI
+                                                                    CPU_OP(ed_reti)
                                                                     cpu.IEF1 = cpu.IEF2;
                                                                     cpu_return();
                                                                     break;
                                                                 case 2: // LEA IY, IX + d
+                                                                    CPU_OP(ed_lea_iy_ix)
                                                                     cpu.PREFIX = 2;
                                                                     r->IY = cpu_index_address();
                                                                     break;
@@ -1366,14 +2227,17 @@ void cpu_execute(void) {
                                                                     cpu_trap();
                                                                     break;
                                                                 case 4: // PEA IX + d
+                                                                    CPU_OP(ed_pea_ix)
                                                                     cpu_push_word((int32_t)r->IX + cpu_fetch_offset());
                                                                     break;
                                                                 case 5: // LD MB, A
+                                                                    CPU_OP(ed_ld_mb_a)
                                                                     if (cpu.ADL) {
                                                                         r->MBASE = r->A;
                                                                     }
                                                                     break;
                                                                 case 7: // STMIX
+                                                                    CPU_OP(ed_stmix)
                                                                     cpu.MADL = 1;
                                                                     break;
                                                             }
@@ -1383,20 +2247,25 @@ void cpu_execute(void) {
                                                                 case 0:
                                                                 case 2:
                                                                 case 3: // IM im[y]
+                                                                    CPU_OP(ed_im)
                                                                     cpu.IM = context.y;
                                                                     break;
                                                                 case 1: // OPCODETRAP
                                                                     cpu_trap();
                                                                     break;
                                                                 case 4: // PEA IY + d
+                                                                    CPU_OP(ed_pea_iy)
                                                                     cpu_push_word((int32_t)r->IY + cpu_fetch_offset());
                                                                     break;
                                                                 case 5: // LD A, MB
+                                                                    CPU_OP(ed_ld_a_mb)
                                                                     r->A = r->MBASE;
                                                                     break;
                                                                 case 6: // SLP -- NOT IMPLEMENTED
+                                                                    CPU_OP(ed_slp)
                                                                     break;
                                                                 case 7: // RSMIX
+                                                                    CPU_OP(ed_rsmix)
                                                                     cpu.MADL = 0;
                                                                     break;
                                                             }
@@ -1404,24 +2273,35 @@ void cpu_execute(void) {
                                                         case 7:
                                                             switch (context.y) {
                                                                 case 0: // LD I, A
+                                                                    CPU_OP(ed_ld_i_a)
                                                                     r->I = r->A | (r->I & 0xF0);
                                                                     break;
                                                                 case 1: // LD R, A
+                                                                    CPU_OP(ed_ld_r_a)
                                                                     r->R = r->A << 1 | r->A >> 7;
+#ifdef IDLE_SKIP
+                                                                    idle.clean = false;
+#endif
                                                                     break;
                                                                 case 2: // LD A, I
+                                                                    CPU_OP(ed_ld_a_i)
                                                                     r->A = r->I & 0x0F;
                                                                     r->F = cpuflag_sign_b(r->A) | cpuflag_zero(r->A)
                                                                         | cpuflag_undef(r->F) | cpuflag_pv(cpu.IEF1)
                                                                         | cpuflag_subtract(0) | cpuflag_c(r->flags.C);
                                                                     break;
                                                                 case 3: // LD A, R
+                                                                    CPU_OP(ed_ld_a_r)
                                                                     r->A = r->R >> 1 | r->R << 7;
+#ifdef IDLE_SKIP
+                                                                    idle.clean = false;
+#endif
                                                                     r->F = cpuflag_sign_b(r->A) | cpuflag_zero(r->A)
                                                                         | cpuflag_undef(r->F) | cpuflag_pv(cpu.IEF1)
                                                                         | cpuflag_subtract(0) | cpuflag_c(r->flags.C);
                                                                     break;
                                                                 case 4: // RRD
+                                                                    CPU_OP(ed_rrd)
                                                                     old = r->A;
                                                                     new = cpu_read_byte(r->HL);
                                                                     r->A &= 0xF0;
@@ -1433,6 +2313,7 @@ void cpu_execute(void) {
                                                                         | cpuflag_parity(r->A) | cpuflag_undef(r->F);
                                                                     break;
                                                                 case 5: // RLD
+                                                                    CPU_OP(ed_rld)
                                                                     old = r->A;
                                                                     new = cpu_read_byte(r->HL);
                                                                     r->A &= 0xF0;
@@ -1451,18 +2332,23 @@ void cpu_execute(void) {
                                                     }
                                                     break;
                                                 case 2:
+                                                    CPU_OP(ed_bli)
                                                 cpu_execute_bli_start:
                                                     r->PC = cpu_address_mode(r->PC - 2 - cpu.SUFFIX, cpu.ADL);
                                                     cpu.context = context;
                                                 cpu_execute_bli_continue:
                                                     cpu_execute_bli();
                                                     if (cpu.inBlock) {
+#ifdef DECODE_CACHE
+                                                        cpu_decode_stop();
+#endif
                                                         goto cpu_execute_continue;
                                                     } else {
                                                         r->PC = cpu_address_mode(r->PC + 2 + cpu.SUFFIX, cpu.ADL);
                                                     }
                                                     break;
                                                 case 3:  // There are only a few of these, so a simple switch for these shouldn't matter too much
+                                                    CPU_OP(ed_x3)
                                                     switch(context.opcode) {
                                                         case 0xC2: // INIRX
                                                         case 0xC3: // OTIRX
@@ -1486,6 +2372,7 @@ void cpu_execute(void) {
                                             }
                                             break;
                                         case 3: // 0xFD prefixed opcodes
+                                            CPU_OP(fd)
                                             cpu.PREFIX = 3;
                                             continue;
                                     }
@@ -1493,9 +2380,11 @@ void cpu_execute(void) {
                             }
                             break;
                         case 6: // alu[y] n
+                            CPU_OP(alu_n)
                             cpu_execute_alu(context.y, cpu_fetch_byte());
                             break;
                         case 7: // RST y*8
+                            CPU_OP(rst)
                             cpu.cycles++;
                             cpu_call(context.y << 3, cpu.SUFFIX);
                             break;
@@ -1503,18 +2392,50 @@ void cpu_execute(void) {
                     break;
             }
             cpu_clear_mode();
+#ifdef DECODE_CACHE
+            cpu_decode_commit();
+#endif
         } while (cpu.PREFIX || cpu.SUFFIX || cpu.cycles < cpu.next);
     }
+#ifdef CPU_LAZY_FLAGS
+    cpu_flags_sync();
+#endif
+}
+
+#ifndef CPU_LEAN
+#ifdef DEBUG_SUPPORT
+void cpu_execute(void) {
+    static bool lean;
+    if (debug_armed()) {
+        lean = false;
+        cpu_execute_debug();
+    } else {
+        if (!lean) {
+            /* the decode state is behind whatever ran instrumented */
+            cpu_decode_flush();
+            lean = true;
+        }
+        cpu_execute_lean();
+    }
 }
+#endif
 
 bool cpu_restore(const emu_image *s) {
+    cpu_decode_flush();
+#ifdef CPU_LAZY_FLAGS
+    lazy.pending = false;
+#endif
     cpu = s->cpu;
     cpuEvents = s->cpu.cpuEventsState;
     return true;
 }
 
 bool cpu_save(emu_image *s) {
+#ifdef CPU_LAZY_FLAGS
+    cpu_flags_sync();
+#endif
     s->cpu = cpu;
     s->cpu.cpuEventsState = cpuEvents;
     return true;
 }
+#endif
@@ -65,8 +65,7 @@ PACK(typedef ALIGNED_(8) struct eZ80cpu {
         uint8_t inBlock     : 1;  /* Are we processing a block instruction?                                                      */
     };
     eZ80context_t context;
-    uint32_t cycles, next;
-    int64_t cycles_offset;
+    uint64_t cycles, next;
     uint8_t prefetch, bus;
     uint32_t cpuEventsState;
 }) eZ80cpu_t;
@@ -80,6 +79,24 @@ void cpu_reset(void);
 void cpu_flush(uint32_t, bool);
 void cpu_nmi(void);
 void cpu_execute(void);
+#ifdef DEBUG_SUPPORT
+/* Same core without debugger hooks, see cpu_lean.c */
+void cpu_execute_lean(void);
+#endif
+
+/* Direct fetch window, closed when flash commands change what reads return */
+void cpu_fetch_invalidate(void);
+
+/* Predecoded instruction cache */
+void cpu_decode_flush(void);
+void cpu_decode_invalidate(uint32_t address);
+void cpu_decode_invalidate_range(uint32_t start, uint32_t end);
+
+/* Cycles fast forwarded through idle loops */
+uint64_t cpu_idle_skipped(void);
+/* Stops the current idle loop from being skipped, call when state it may poll
+ * changes outside of scheduled events */
+void cpu_idle_invalidate(void);
 
 /* Save/Restore */
 typedef struct emu_image emu_image;
@@ -0,0 +1,15 @@
+/* Lean copy of the cpu core for debug builds, without any debugger hooks.
+ * cpu_execute() switches to it whenever nothing is being debugged. */
+#ifdef DEBUG_SUPPORT
+
+#include "cpu.h"
+#include "emu.h"
+#include "mem.h"
+#include "port.h"
+#include "debug/debug.h"
+
+#undef DEBUG_SUPPORT
+#define CPU_LEAN
+#include "cpu.c"
+
+#endif
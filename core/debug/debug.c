@@ -13,7 +13,6 @@ debug_state_t debugger;
 
 void debugger_init(void) {
     debugger.stepOverInstrEnd = -1;
-    debugger.data.block = (uint8_t*)calloc(0x1000000, sizeof(uint8_t));    /* Allocate Debug memory */
     debugger.data.ports = (uint8_t*)calloc(0x10000, sizeof(uint8_t));      /* Allocate Debug Port Monitor */
     debugger.buffer = (char*)malloc(SIZEOF_DBG_BUFFER * sizeof(char));     /* Used for printing to the console */
     debugger.errBuffer = (char*)malloc(SIZEOF_DBG_BUFFER * sizeof(char));  /* Used for printing to the console */
@@ -22,17 +21,35 @@ void debugger_init(void) {
     gui_console_printf("[CEmu] Initialized Debugger...\n");
 }
 
+static void debug_map_free(debug_map_t *map) {
+    unsigned int i;
+    for (i = 0; i < sizeof map->page / sizeof map->page[0]; i++) {
+        free(map->page[i]);
+        map->page[i] = NULL;
+    }
+}
+
 void debugger_free(void) {
-    free(debugger.data.block);
+    debug_map_free(&debugger.data.block);
+    debug_map_free(&debugger.data.markers);
     free(debugger.data.ports);
     free(debugger.buffer);
     gui_console_printf("[CEmu] Freed Debugger.\n");
 }
 
+uint8_t *debug_map_alloc(debug_map_t *map, uint32_t address) {
+    uint8_t *page = (uint8_t*)calloc(DBG_MAP_PAGE_SIZE, sizeof(uint8_t));
+    if (!page) {
+        gui_console_printf("[CEmu] Out of memory, couldn't set debug flags at address %#06x.\n", address & 0xFFFFFF);
+        return NULL;
+    }
+    return map->page[(address & 0xFFFFFF) >> DBG_MAP_PAGE_BITS] = page;
+}
+
 uint8_t debug_peek_byte(uint32_t address) {
     uint8_t value = mem_peek_byte(address), debugData;
 
-    if ((debugData = debugger.data.block[address])) {
+    if ((debugData = debug_map_get(&debugger.data.block, address) | debug_map_get(&debugger.data.markers, address))) {
         disasmHighlight.hit_read_watchpoint |= debugData & DBG_READ_WATCHPOINT;
         disasmHighlight.hit_write_watchpoint |= debugData & DBG_WRITE_WATCHPOINT;
         disasmHighlight.hit_exec_breakpoint |= debugData & DBG_EXEC_BREAKPOINT;
@@ -48,6 +65,10 @@ uint8_t debug_peek_byte(uint32_t address) {
     return value;
 }
 
+static bool debugger_closed(void) {
+    return !inDebugger;
+}
+
 void open_debugger(int reason, uint32_t data) {
     if (inDebugger) {
         /* Prevent recurse */
@@ -56,7 +77,7 @@ void open_debugger(int reason, uint32_t data) {
 
     if ((reason == DBG_STEP) && debugger.stepOverFirstStep) {
         if (((cpuEvents & EVENT_DEBUG_STEP_NEXT)
-                && !(debugger.data.block[cpu.registers.PC] & DBG_TEMP_EXEC_BREAKPOINT)) || (cpuEvents & EVENT_DEBUG_STEP_OUT)) {
+                && !(debug_map_get(&debugger.data.block, cpu.registers.PC) & DBG_TEMP_EXEC_BREAKPOINT)) || (cpuEvents & EVENT_DEBUG_STEP_OUT)) {
             debugger.stepOverFirstStep = false;
             gui_debugger_raise_or_disable(inDebugger = false);
             return;
@@ -66,7 +87,7 @@ void open_debugger(int reason, uint32_t data) {
 
     debugger.cpu_cycles = cpu.cycles;
     debugger.cpu_next = cpu.next;
-    debugger.total_cycles = cpu.cycles + cpu.cycles_offset;
+    debugger.total_cycles = cpu.cycles - debugger.total_start;
 
     if (debugger.currentBuffPos) {
         debugger.buffer[debugger.currentBuffPos] = '\0';
@@ -84,12 +105,12 @@ void open_debugger(int reason, uint32_t data) {
     gui_debugger_send_command(reason, data);
 
     while (inDebugger) {
-        gui_emu_sleep(50);
+        gui_emu_wait(debugger_closed);
     }
 
     cpu.next = debugger.cpu_next;
     cpu.cycles = debugger.cpu_cycles;
-    cpu.cycles_offset = debugger.total_cycles - cpu.cycles;
+    debugger.total_start = cpu.cycles - debugger.total_cycles;
 
     if (cpuEvents & EVENT_DEBUG_STEP) {
         cpu.next = cpu.cycles + 1;
@@ -108,11 +129,13 @@ void debug_switch_step_mode(void) {
 }
 
 void debug_breakwatch(uint32_t address, unsigned int type, bool set) {
+    bool was = debug_map_get(&debugger.data.block, address) & (DBG_RW_WATCHPOINT | DBG_EXEC_BREAKPOINT);
     if (set) {
-        debugger.data.block[address] |= type;
+        debug_map_set(&debugger.data.block, address, type);
     } else {
-        debugger.data.block[address] &= ~type;
+        debug_map_clear(&debugger.data.block, address, type);
     }
+    debugger.numBreakwatch += (bool)(debug_map_get(&debugger.data.block, address) & (DBG_RW_WATCHPOINT | DBG_EXEC_BREAKPOINT)) - was;
 }
 
 void debug_init_run_until(uint32_t address) {
@@ -123,9 +146,9 @@ void debug_clear_temp_break(void) {
     cpuEvents &= ~(EVENT_DEBUG_STEP | EVENT_DEBUG_STEP_OUT | EVENT_DEBUG_STEP_OVER);
     if (debugger.stepOverInstrEnd != 0xFFFFFFFFU) {
         do {
-            debugger.data.block[debugger.stepOverInstrEnd] &= ~DBG_TEMP_EXEC_BREAKPOINT;
+            debug_map_clear(&debugger.data.block, debugger.stepOverInstrEnd, DBG_TEMP_EXEC_BREAKPOINT);
             debugger.stepOverInstrEnd = cpu_mask_mode(debugger.stepOverInstrEnd - 1, debugger.stepOverMode);
-        } while (debugger.data.block[debugger.stepOverInstrEnd] & DBG_TEMP_EXEC_BREAKPOINT);
+        } while (debug_map_get(&debugger.data.block, debugger.stepOverInstrEnd) & DBG_TEMP_EXEC_BREAKPOINT);
     }
     debugger.stepOverInstrEnd = 0xFFFFFFFFU;
 }
@@ -139,15 +162,22 @@ void debug_breakpoint_remove(uint32_t address) {
 }
 
 void debug_pmonitor_set(uint16_t address, unsigned int type, bool set) {
+    bool was = debugger.data.ports[address] != DBG_NO_HANDLE;
     if (set) {
         debugger.data.ports[address] |= type;
     } else {
         debugger.data.ports[address] &= ~type;
     }
+    debugger.numPmonitor += (debugger.data.ports[address] != DBG_NO_HANDLE) - was;
 }
 
 void debug_pmonitor_remove(uint16_t address) {
     debug_pmonitor_set(address, ~DBG_NO_HANDLE, false);
 }
 
+bool debug_armed(void) {
+    return debugger.numBreakwatch || debugger.numPmonitor || debugger.stepOverInstrEnd != 0xFFFFFFFFU ||
+           (cpuEvents & (EVENT_DEBUG_STEP | EVENT_DEBUG_STEP_OVER | EVENT_DEBUG_STEP_NEXT | EVENT_DEBUG_STEP_OUT));
+}
+
 #endif
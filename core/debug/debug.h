@@ -53,14 +53,24 @@ enum {
 #define DBGERR_PORT_RANGE         0xFC0000
 #define SIZEOF_DBG_BUFFER         0x1000
 
+/* Sparse map of debug flags, with a 4KB page of flags allocated the first
+ * time something in it is set. Unallocated pages have no flags at all. */
+#define DBG_MAP_PAGE_BITS         12
+#define DBG_MAP_PAGE_SIZE         (1 << DBG_MAP_PAGE_BITS)
+
+typedef struct {
+    uint8_t *page[0x1000000 >> DBG_MAP_PAGE_BITS];
+} debug_map_t;
+
 typedef struct {
-    uint8_t *block;
+    debug_map_t block;      /* breakpoints and watchpoints */
+    debug_map_t markers;    /* instruction boundaries seen while instrumented */
     uint8_t *ports;
 } debug_data_t;
 
 typedef struct {        /* For debugging */
-    int cpu_cycles;
-    int cpu_next;
+    uint64_t cpu_cycles;
+    uint64_t cpu_next;
     char *buffer;
     char *errBuffer;
     bool resetOpensDebugger;
@@ -78,6 +88,9 @@ typedef struct {        /* For debugging */
     volatile uint32_t currentBuffPos;
     volatile uint32_t currentErrBuffPos;
     uint64_t total_cycles;
+    uint64_t total_start;       /* cpu cycle total_cycles counts from */
+    uint32_t numBreakwatch;     /* addresses with breakpoints or watchpoints */
+    uint32_t numPmonitor;       /* ports being monitored */
 } debug_state_t;
 
 /* Debugging */
@@ -86,6 +99,29 @@ extern debug_state_t debugger;
 void debugger_init(void);
 void debugger_free(void);
 
+/* Returns NULL if the page couldn't be allocated */
+uint8_t *debug_map_alloc(debug_map_t *map, uint32_t address);
+
+static inline uint8_t debug_map_get(const debug_map_t *map, uint32_t address) {
+    const uint8_t *page = map->page[(address & 0xFFFFFF) >> DBG_MAP_PAGE_BITS];
+    return page ? page[address & (DBG_MAP_PAGE_SIZE - 1)] : 0;
+}
+/* Returns false if the flags couldn't be set */
+static inline bool debug_map_set(debug_map_t *map, uint32_t address, uint8_t flags) {
+    uint8_t *page = map->page[(address & 0xFFFFFF) >> DBG_MAP_PAGE_BITS];
+    if (!page && !(page = debug_map_alloc(map, address))) {
+        return false;
+    }
+    page[address & (DBG_MAP_PAGE_SIZE - 1)] |= flags;
+    return true;
+}
+static inline void debug_map_clear(debug_map_t *map, uint32_t address, uint8_t flags) {
+    uint8_t *page = map->page[(address & 0xFFFFFF) >> DBG_MAP_PAGE_BITS];
+    if (page) {
+        page[address & (DBG_MAP_PAGE_SIZE - 1)] &= ~flags;
+    }
+}
+
 uint8_t debug_peek_byte(uint32_t address);
 void open_debugger(int reason, uint32_t address);
 void debug_switch_step_mode(void);
@@ -98,6 +134,9 @@ void debug_breakpoint_remove(uint32_t address);
 void debug_pmonitor_set(uint16_t address, unsigned int type, bool set);
 void debug_pmonitor_remove(uint16_t address);
 
+/* True when the cpu needs to run instrumented */
+bool debug_armed(void);
+
 void debug_set_pc_address(uint32_t address);
 
 void debug_clear_temp_break(void);
@@ -14,7 +14,7 @@ void debug_set_step_next(void) {
     disassembleInstruction();
     debugger.stepOverFirstStep = true;
     debugger.stepOverInstrEnd = disasm.new_address;
-    debugger.data.block[debugger.stepOverInstrEnd] |= DBG_TEMP_EXEC_BREAKPOINT;
+    debug_map_set(&debugger.data.block, debugger.stepOverInstrEnd, DBG_TEMP_EXEC_BREAKPOINT);
     debugger.stepOverMode = cpu.ADL;
     debugger.stepOutSPL = 0;
     debugger.stepOutSPS = 0;
@@ -28,7 +28,7 @@ void debug_set_step_in(void) {
     disasm.adl = cpu.ADL;
     disassembleInstruction();
     debugger.stepOverInstrEnd = disasm.new_address;
-    debugger.data.block[debugger.stepOverInstrEnd] |= DBG_TEMP_EXEC_BREAKPOINT;
+    debug_map_set(&debugger.data.block, debugger.stepOverInstrEnd, DBG_TEMP_EXEC_BREAKPOINT);
     debugger.stepOverMode = cpu.ADL;
     debugger.stepOverFirstStep = false;
     cpuEvents |= EVENT_DEBUG_STEP;
@@ -40,7 +40,7 @@ void debug_set_step_over(void) {
     disasm.adl = cpu.ADL;
     disassembleInstruction();
     debugger.stepOverInstrEnd = disasm.new_address;
-    debugger.data.block[debugger.stepOverInstrEnd] |= DBG_TEMP_EXEC_BREAKPOINT;
+    debug_map_set(&debugger.data.block, debugger.stepOverInstrEnd, DBG_TEMP_EXEC_BREAKPOINT);
     debugger.stepOverMode = cpu.ADL;
     debugger.stepOverFirstStep = false;
     cpuEvents |= EVENT_DEBUG_STEP | EVENT_DEBUG_STEP_OVER;
@@ -49,7 +49,7 @@ void debug_set_step_over(void) {
 void debug_set_run_until(void) {
     debug_clear_temp_break();
     debugger.stepOverInstrEnd = debugger.runUntilAddress;
-    debugger.data.block[debugger.stepOverInstrEnd] |= DBG_TEMP_EXEC_BREAKPOINT;
+    debug_map_set(&debugger.data.block, debugger.stepOverInstrEnd, DBG_TEMP_EXEC_BREAKPOINT);
     debugger.stepOverMode = cpu.ADL;
     debugger.stepOverFirstStep = false;
     cpuEvents &= ~(EVENT_DEBUG_STEP | EVENT_DEBUG_STEP_OVER | EVENT_DEBUG_STEP_OUT | EVENT_DEBUG_STEP_NEXT);
@@ -8,6 +8,7 @@
 #endif
 
 #include "emu.h"
+#include "emuimage.h"
 #include "dma.h"
 #include "asic.h"
 #include "cert.h"
@@ -15,18 +16,52 @@
 #include "schedule.h"
 #include "debug/debug.h"
 
-#define imageVersion 0xCECE000A
+#define imageVersion 0xCECE000E
 
 uint32_t cpuEvents;
 volatile bool exiting;
 volatile bool emulationPaused;
+bool mapRomFile;
+volatile uint32_t throttleSlice = THROTTLE_FRAME;
+
+/* scheduler item that ends a synchronous run of frames */
+static int runFramesItem;
+static uint64_t runStop;
+static bool running;
+
+static void run_stop_at(uint64_t cycle) {
+    runStop = cycle;
+    sched_set_stop(cycle);
+}
 
 void throttle_interval_event(int index) {
-    event_repeat(index, 27000000 / 60);
+    static uint32_t frameTicks;
+    uint32_t slice = throttleSlice;
 
-    gui_do_stuff();
+    if (!slice || slice > THROTTLE_FRAME) {
+        slice = THROTTLE_FRAME;
+    }
+    event_repeat(index, slice);
+
+    /* the gui still only gets a chance to run once per frame */
+    frameTicks += slice;
+    if (frameTicks >= THROTTLE_FRAME) {
+        frameTicks -= THROTTLE_FRAME;
+        gui_do_stuff();
+    }
+
+    if (!running) {
+        throttle_timer_wait(slice);
+    }
+}
+
+static void run_frames_event(int index) {
+    (void)index;
+    run_stop_at(cpu.cycles);
+}
 
-    throttle_timer_wait();
+static void run_register_events(void) {
+    runFramesItem = sched_register(CLOCK_27M, run_frames_event);
 }
 
 bool emu_save_rom(const char *file) {
@@ -73,7 +108,7 @@ bool emu_save(const char *file) {
 
         image->version = imageVersion;
 
-        success = (fwrite(image, 1, size, savedImage) == size);
+        success = emu_image_write(savedImage, image);
     } while (0);
 
     free(image);
@@ -94,6 +129,7 @@ bool emu_start(const char *romImage, const char *savedImage) {
     do {
         if (savedImage != NULL) {
             emu_image_t *image;
+            void *data;
             imageFile = fopen_utf8(savedImage, "rb");
 
             if (!imageFile) {
@@ -109,22 +145,39 @@ bool emu_start(const char *romImage, const char *savedImage) {
             if (fseek(imageFile, 0L, SEEK_SET) < 0) {
                 break;
             }
-            if ((size_t)lSize < sizeof(emu_image_t)) {
+            if (!lSize) {
                 break;
             }
 
-            image = (emu_image_t*)malloc(lSize);
-            if (!image) {
+            data = malloc(lSize);
+            if (!data) {
                 break;
             }
-            if (fread(image, lSize, 1, imageFile) != 1) {
-                free(image);
+            if (fread(data, lSize, 1, imageFile) != 1) {
+                free(data);
+                break;
+            }
+
+            /* older versions wrote the image out raw */
+            if (emu_image_is_packed(data, lSize)) {
+                image = (emu_image_t*)malloc(sizeof(emu_image_t));
+                if (!image || !emu_image_unpack(image, data, lSize, imageVersion)) {
+                    free(image);
+                    free(data);
+                    break;
+                }
+                free(data);
+            } else if ((size_t)lSize < sizeof(emu_image_t)) {
+                free(data);
                 break;
+            } else {
+                image = (emu_image_t*)data;
             }
 
             sched_reset();
             sched.items[SCHED_THROTTLE].clock = CLOCK_27M;
             sched.items[SCHED_THROTTLE].proc = throttle_interval_event;
+            run_register_events();
 
             asic_init();
             asic_reset();
@@ -166,8 +219,9 @@ bool emu_start(const char *romImage, const char *savedImage) {
                             break;
                         }
 
-                        /* Read whole ROM. */
-                        if (fread(mem.flash.block, 1, lSize, romFile) < (size_t)lSize) {
+                        /* Map or read whole ROM. */
+                        if (!(mapRomFile && lSize >= flash_size && mem_map_flash(romImage)) &&
+                            fread(mem.flash.block, 1, lSize, romFile) < (size_t)lSize) {
                             break;
                         }
 
@@ -300,12 +354,13 @@ void emu_cleanup(void) {
     asic_free();
 }
 
-static void EMSCRIPTEN_KEEPALIVE emu_reset(void) {
+void EMSCRIPTEN_KEEPALIVE emu_reset(void) {
     /* Reset the scheduler */
     sched_reset();
 
     sched.items[SCHED_THROTTLE].clock = CLOCK_27M;
     sched.items[SCHED_THROTTLE].proc = throttle_interval_event;
+    run_register_events();
 
     /* Reset the ASIC */
     asic_reset();
@@ -316,13 +371,21 @@ static void EMSCRIPTEN_KEEPALIVE emu_reset(void) {
     sched_update_next_event();
 }
 
+static void emu_check_reset(void) {
+    if (cpuEvents & EVENT_RESET) {
+        gui_console_printf("[CEmu] Calculator reset triggered...\n");
+        cpu_reset();
+        cpuEvents &= ~EVENT_RESET;
+    }
+}
+
+static bool emu_can_run(void) {
+    return exiting || (!emulationPaused && !asic.shipModeEnabled);
+}
+
 static void emu_main_loop_inner(void) {
     if (!emulationPaused) {
-        if (cpuEvents & EVENT_RESET) {
-            gui_console_printf("[CEmu] Calculator reset triggered...\n");
-            cpu_reset();
-            cpuEvents &= ~EVENT_RESET;
-        }
+        emu_check_reset();
 #ifdef DEBUG_SUPPORT
         if (!cpu.halted && (cpuEvents & EVENT_DEBUG_STEP)) {
             cpuEvents &= ~EVENT_DEBUG_STEP;
@@ -331,12 +394,15 @@ static void emu_main_loop_inner(void) {
 #endif
         if (!asic.shipModeEnabled) {
             sched_process_pending_events();
-            cpu_execute();
+            /* a reset from an event happens before any more instructions */
+            if (!(cpuEvents & EVENT_RESET)) {
+                cpu_execute();
+            }
         } else {
-            gui_emu_sleep(50);
+            gui_emu_wait(emu_can_run);
         }
     } else {
-        gui_emu_sleep(50);
+        gui_emu_wait(emu_can_run);
     }
 }
 
@@ -358,6 +424,60 @@ void emu_loop(bool reset) {
     emu_cleanup();
 }
 
+/* Runs until the cpu reaches the stop cycle, ending early in ship mode since time doesn't pass there */
+static void emu_run(uint64_t stop) {
+    running = true;
+    run_stop_at(stop);
+    for (;;) {
+        emu_check_reset();
+        if (exiting || asic.shipModeEnabled) {
+            break;
+        }
+        sched_process_pending_events();
+        if (cpu.cycles >= runStop) {
+            break;
+        }
+        if (!(cpuEvents & EVENT_RESET)) {
+            cpu_execute();
+        }
+    }
+    run_stop_at(UINT64_MAX);
+    running = false;
+}
+
+uint64_t emu_run_cycles(uint64_t cycles) {
+    uint64_t start = cpu.cycles;
+    emu_run(start + cycles);
+    return cpu.cycles - start;
+}
+
+uint64_t emu_run_frames(uint32_t frames) {
+    uint64_t start = cpu.cycles;
+    /* the frame item moves the stop back to when it fires */
+    event_set(runFramesItem, (uint64_t)frames * THROTTLE_FRAME);
+    emu_run(UINT64_MAX);
+    event_clear(runFramesItem);
+    return cpu.cycles - start;
+}
+
+bool emu_run_until(bool (*predicate)(void *data), void *data, uint64_t maxCycles) {
+    uint64_t start = cpu.cycles;
+    while (!predicate(data)) {
+        uint64_t step = 1, left = maxCycles - (cpu.cycles - start);
+        if (exiting || asic.shipModeEnabled || cpu.cycles - start >= maxCycles) {
+            return false;
+        }
+        /* a one cycle deadline ends the run after a single instruction,
+         * a halted cpu executes none until the next event */
+        if (cpu.halted && sched.nextCPUtick > cpu.cycles) {
+            step = sched.nextCPUtick - cpu.cycles;
+        }
+        emu_run_cycles(step < left ? step : left);
+    }
+    return true;
+}
+
 void EMSCRIPTEN_KEEPALIVE emu_set_emulation_paused(bool paused) {
     emulationPaused = paused;
+    gui_emu_wake();
 }
@@ -65,6 +65,7 @@ extern uint32_t cpuEvents;
 /* Settings */
 extern volatile bool exiting;
 extern volatile bool emulationPaused;
+extern bool mapRomFile;     /* share unmodified rom pages between instances */
 
 /* Reimplemented GUI callbacks */
 void gui_do_stuff(void);
@@ -76,16 +77,37 @@ void gui_debugger_send_command(int, uint32_t);
 void gui_render_gif_frame(void);
 void gui_set_busy(bool);
 void gui_emu_sleep(unsigned long);
+/* Blocks the emu thread until ready() may hold, callers recheck in a loop */
+void gui_emu_wait(bool (*ready)(void));
+/* Call after changing state that a gui_emu_wait caller waits on */
+void gui_emu_wake(void);
 
 bool emu_start(const char*,const char*);
 void emu_loop(bool);
+void emu_reset(void);
 void emu_cleanup(void);
 bool emu_save(const char*);
 bool emu_save_rom(const char*);
 void emu_set_emulation_paused(bool);
 
+/* Synchronous execution, an alternative to emu_loop for embedders: call emu_reset
+ * once after emu_start, then these from any one thread. They run without
+ * throttling and return at the first instruction boundary at or after the limit.
+ * A frame is 1/60 second of emulated time. */
+uint64_t emu_run_cycles(uint64_t cycles);   /* returns the cycles run */
+uint64_t emu_run_frames(uint32_t frames);   /* returns the cycles run */
+/* Checks the predicate before every instruction, false if maxCycles passed first */
+bool emu_run_until(bool (*predicate)(void *data), void *data, uint64_t maxCycles);
+
+/* Length of a gui frame in 27MHz ticks */
+#define THROTTLE_FRAME (27000000 / 60)
+
+/* Emulated 27MHz ticks between calls to throttle_timer_wait, at most one frame.
+ * Read once per slice, so other threads may change it at any time. */
+extern volatile uint32_t throttleSlice;
+
 void throttle_interval_event(int index);
-void throttle_timer_wait(void);
+void throttle_timer_wait(uint32_t ticks); /* ticks emulated since the last call */
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "emuimage.h"
+
+#define IMAGE_CHUNK_SIZE 0x10000
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+#define LZ_MAX_OFFSET 0xFFFF
+
+static uint32_t crc_table[256];
+
+static uint32_t image_crc32(const uint8_t *data, size_t size) {
+    uint32_t crc = ~0U;
+    if (!crc_table[1]) {
+        uint32_t i, j, c;
+        for (i = 0; i < 256; i++) {
+            for (c = i, j = 0; j < 8; j++) {
+                c = c & 1 ? 0xEDB88320 ^ c >> 1 : c >> 1;
+            }
+            crc_table[i] = c;
+        }
+    }
+    while (size--) {
+        crc = crc_table[(crc ^ *data++) & 0xFF] ^ crc >> 8;
+    }
+    return ~crc;
+}
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint8_t *lz_put_length(uint8_t *op, const uint8_t *oend, size_t len) {
+    for (; len >= 255; len -= 255) {
+        if (op >= oend) {
+            return NULL;
+        }
+        *op++ = 255;
+    }
+    if (op >= oend) {
+        return NULL;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/* One sequence: a token with both lengths, literals, then the match if there is one */
+static uint8_t *lz_put_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *lit, size_t litLen, size_t offset, size_t matchLen) {
+    size_t extra = matchLen ? matchLen - LZ_MIN_MATCH : 0;
+    if (op >= oend) {
+        return NULL;
+    }
+    *op++ = (uint8_t)((litLen < 15 ? litLen : 15) << 4 | (extra < 15 ? extra : 15));
+    if (litLen >= 15 && !(op = lz_put_length(op, oend, litLen - 15))) {
+        return NULL;
+    }
+    if ((size_t)(oend - op) < litLen) {
+        return NULL;
+    }
+    memcpy(op, lit, litLen);
+    op += litLen;
+    if (matchLen) {
+        if (oend - op < 2) {
+            return NULL;
+        }
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        if (extra >= 15 && !(op = lz_put_length(op, oend, extra - 15))) {
+            return NULL;
+        }
+    }
+    return op;
+}
+
+/* Returns the packed size, or 0 if it wouldn't fit in capacity */
+static size_t lz_compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity) {
+    static uint32_t table[1 << LZ_HASH_BITS];
+    const uint8_t *ip = src, *anchor = src, *end = src + size;
+    uint8_t *op = dst, *oend = dst + capacity;
+
+    memset(table, 0, sizeof(table));
+    while (end - ip >= LZ_MIN_MATCH) {
+        uint32_t seq = read32(ip);
+        uint32_t hash = (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+        /* slots hold the position + 1 of the last sequence with that hash, 0 when empty */
+        size_t pos = ip - src, last = table[hash];
+        const uint8_t *ref = last ? src + last - 1 : NULL;
+        bool hit = ref && pos - (last - 1) <= LZ_MAX_OFFSET && read32(ref) == seq;
+
+        table[hash] = (uint32_t)pos + 1;
+        if (hit) {
+            size_t len = LZ_MIN_MATCH;
+            while (ip + len < end && ip[len] == ref[len]) {
+                len++;
+            }
+            if (!(op = lz_put_sequence(op, oend, anchor, ip - anchor, ip - ref, len))) {
+                return 0;
+            }
+            ip += len;
+            anchor = ip;
+        } else {
+            ip++;
+        }
+    }
+    if (!(op = lz_put_sequence(op, oend, anchor, end - anchor, 0, 0))) {
+        return 0;
+    }
+    return op - dst;
+}
+
+static bool lz_get_length(const uint8_t **ip, const uint8_t *end, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+static bool lz_decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t rawSize) {
+    const uint8_t *ip = src, *end = src + size;
+    uint8_t *op = dst, *oend = dst + rawSize;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t len = token >> 4, offset;
+
+        if (len == 15 && !lz_get_length(&ip, end, &len)) {
+            return false;
+        }
+        if ((size_t)(end - ip) < len || (size_t)(oend - op) < len) {
+            return false;
+        }
+        memcpy(op, ip, len);
+        ip += len;
+        op += len;
+        if (ip == end) {
+            break;
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        len = token & 15;
+        if (len == 15 && !lz_get_length(&ip, end, &len)) {
+            return false;
+        }
+        len += LZ_MIN_MATCH;
+        if (!offset || offset > (size_t)(op - dst) || (size_t)(oend - op) < len) {
+            return false;
+        }
+        /* overlapping copies repeat the last offset bytes */
+        for (; len; len--, op++) {
+            *op = op[-(ptrdiff_t)offset];
+        }
+    }
+    return op == oend;
+}
+
+static bool is_fill(const uint8_t *data, size_t size) {
+    size_t i;
+    for (i = 1; i < size; i++) {
+        if (data[i] != data[0]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool emu_image_write(FILE *file, const emu_image_t *image) {
+    const uint8_t *raw = (const uint8_t*)image;
+    const size_t size = sizeof(emu_image_t), flashStart = offsetof(emu_image_t, mem_flash);
+    emu_image_header_t header;
+    uint8_t *packed;
+    size_t offset, next;
+    bool success = false;
+
+    if (!(packed = (uint8_t*)malloc(IMAGE_CHUNK_SIZE))) {
+        return false;
+    }
+
+    header.magic = IMAGE_FILE_MAGIC;
+    header.format = IMAGE_FILE_FORMAT;
+    header.version = image->version;
+    header.size = size;
+    header.chunks = 0;
+    for (offset = 0; offset < size; offset = next) {
+        next = offset + IMAGE_CHUNK_SIZE < size ? offset + IMAGE_CHUNK_SIZE : size;
+        if (offset < flashStart && next > flashStart) {
+            next = flashStart;
+        }
+        header.chunks++;
+    }
+
+    do {
+        if (fwrite(&header, sizeof(header), 1, file) != 1) {
+            break;
+        }
+        for (offset = 0; offset < size; offset = next) {
+            emu_image_chunk_t chunk;
+            const uint8_t *data = packed;
+
+            next = offset + IMAGE_CHUNK_SIZE < size ? offset + IMAGE_CHUNK_SIZE : size;
+            if (offset < flashStart && next > flashStart) {
+                next = flashStart;
+            }
+
+            chunk.rawSize = next - offset;
+            chunk.crc = image_crc32(raw + offset, chunk.rawSize);
+            if (is_fill(raw + offset, chunk.rawSize)) {
+                chunk.method = IMAGE_CHUNK_FILL;
+                chunk.packedSize = 1;
+                data = raw + offset;
+            } else if ((chunk.packedSize = lz_compress(raw + offset, chunk.rawSize, packed, chunk.rawSize - 1))) {
+                chunk.method = IMAGE_CHUNK_LZ;
+            } else {
+                chunk.method = IMAGE_CHUNK_STORED;
+                chunk.packedSize = chunk.rawSize;
+                data = raw + offset;
+            }
+
+            if (fwrite(&chunk, sizeof(chunk), 1, file) != 1 ||
+                fwrite(data, 1, chunk.packedSize, file) != chunk.packedSize) {
+                break;
+            }
+        }
+        success = offset == size;
+    } while (0);
+
+    free(packed);
+    return success;
+}
+
+bool emu_image_is_packed(const void *data, size_t size) {
+    emu_image_header_t header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    return header.magic == IMAGE_FILE_MAGIC;
+}
+
+bool emu_image_unpack(emu_image_t *image, const void *data, size_t size, uint32_t version) {
+    const uint8_t *ip = (const uint8_t*)data, *end = ip + size;
+    uint8_t *raw = (uint8_t*)image;
+    emu_image_header_t header;
+    size_t offset = 0;
+    uint32_t i;
+
+    if (!emu_image_is_packed(data, size)) {
+        return false;
+    }
+    memcpy(&header, ip, sizeof(header));
+    ip += sizeof(header);
+    if (header.format != IMAGE_FILE_FORMAT || header.version != version || header.size != sizeof(emu_image_t)) {
+        gui_console_printf("[CEmu] Saved state was written by an incompatible version.\n");
+        return false;
+    }
+
+    for (i = 0; i < header.chunks; i++) {
+        emu_image_chunk_t chunk;
+        bool ok;
+
+        if ((size_t)(end - ip) < sizeof(chunk)) {
+            return false;
+        }
+        memcpy(&chunk, ip, sizeof(chunk));
+        ip += sizeof(chunk);
+        if ((size_t)(end - ip) < chunk.packedSize || sizeof(emu_image_t) - offset < chunk.rawSize) {
+            return false;
+        }
+
+        switch (chunk.method) {
+            case IMAGE_CHUNK_STORED:
+                ok = chunk.packedSize == chunk.rawSize;
+                if (ok) {
+                    memcpy(raw + offset, ip, chunk.rawSize);
+                }
+                break;
+            case IMAGE_CHUNK_FILL:
+                ok = chunk.packedSize == 1;
+                if (ok) {
+                    memset(raw + offset, *ip, chunk.rawSize);
+                }
+                break;
+            case IMAGE_CHUNK_LZ:
+                ok = lz_decompress(ip, chunk.packedSize, raw + offset, chunk.rawSize);
+                break;
+            default:
+                ok = false;
+                break;
+        }
+        if (!ok || image_crc32(raw + offset, chunk.rawSize) != chunk.crc) {
+            gui_console_printf("[CEmu] Saved state is corrupted at offset %#x.\n", (unsigned)offset);
+            return false;
+        }
+
+        ip += chunk.packedSize;
+        offset += chunk.rawSize;
+    }
+
+    return offset == sizeof(emu_image_t);
+}
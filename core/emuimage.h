@@ -0,0 +1,47 @@
+#ifndef EMUIMAGE_H
+#define EMUIMAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+#include "defines.h"
+#include "emu.h"
+
+/* Saved state files: a header, then the emu_image_t split into chunks of at
+ * most 64KB, each stored, filled with one byte or lz compressed, with a crc32
+ * of its unpacked data. Flash and ram start on a chunk boundary, so erased
+ * sectors become single fill chunks. */
+
+#define IMAGE_FILE_MAGIC  0x495A4543 /* "CEZI" */
+#define IMAGE_FILE_FORMAT 1
+
+enum { IMAGE_CHUNK_STORED, IMAGE_CHUNK_FILL, IMAGE_CHUNK_LZ };
+
+PACK(typedef struct emu_image_header {
+    uint32_t magic;
+    uint32_t format;
+    uint32_t version;   /* imageVersion of the packed image */
+    uint32_t size;      /* sizeof(emu_image_t) */
+    uint32_t chunks;
+}) emu_image_header_t;
+
+PACK(typedef struct emu_image_chunk {
+    uint32_t rawSize;
+    uint32_t packedSize;
+    uint32_t crc;
+    uint8_t method;
+}) emu_image_chunk_t;
+
+bool emu_image_write(FILE *file, const emu_image_t *image);
+bool emu_image_is_packed(const void *data, size_t size);
+/* Fails unless the image was written with the given imageVersion */
+bool emu_image_unpack(emu_image_t *image, const void *data, size_t size, uint32_t version);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,6 +2,8 @@
 
 #include "flash.h"
 #include "emu.h"
+#include "cpu.h"
+#include "mem.h"
 #include "os/os.h"
 
 /* Global flash state */
@@ -56,8 +58,10 @@ static void flash_write(const uint16_t pio, const uint8_t byte, bool poke) {
             break;
         default:
             flash.ports[index] = byte;
-            break;
+            return;
     }
+    mem_update_map();
+    cpu_decode_flush();
 }
 
 static const eZ80portrange_t device = {
@@ -72,6 +76,7 @@ eZ80portrange_t init_flash(void) {
     flash.ports[0x07] = 0xFF; /* From WikiTI */
     flash.mapped = 1;
     flash_set_map(6);
+    mem_update_map();
 
     gui_console_printf("[CEmu] Initialized Flash Chip...\n");
     return device;
@@ -84,5 +89,6 @@ bool flash_save(emu_image *s) {
 
 bool flash_restore(const emu_image *s) {
     flash = s->flash;
+    mem_update_map();
     return true;
 }
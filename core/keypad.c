@@ -14,12 +14,14 @@ void keypad_intrpt_check() {
 }
 
 void EMSCRIPTEN_KEEPALIVE keypad_key_event(unsigned int row, unsigned int col, bool press) {
+    cpu_idle_invalidate();
     if (row == 2 && col == 0) {
         intrpt_set(INT_ON, press);
         if (press && calc_is_off()) {
             asic.shipModeEnabled = false;
             control.readBatteryStatus = ~1;
             intrpt_pulse(INT_WAKE);
+            gui_emu_wake();
         }
     } else {
         if (press) {
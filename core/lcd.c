@@ -168,40 +168,40 @@ void lcd_reset(void) {
     gui_console_printf("[CEmu] LCD reset.\n");
 }
 
+/* Registers without side effects, served directly by the port tables */
+static const eZ80portreg_t regs[] = {
+    { 0x000, 0x010, lcd.timing,        PORT_READ | PORT_WRITE },
+    { 0x010, 4,     &lcd.upbase,       PORT_READ },
+    { 0x014, 4,     &lcd.lpbase,       PORT_READ },
+    { 0x018, 4,     &lcd.control,      PORT_READ },
+    { 0x01C, 4,     &lcd.imsc,         PORT_READ },
+    { 0x020, 4,     &lcd.ris,          PORT_READ },
+    { 0x200, 0x200, lcd.palette,       PORT_READ | PORT_WRITE },
+    { 0x800, 0x400, lcd.crsrImage,     PORT_READ | PORT_WRITE },
+    { 0xC00, 1,     &lcd.crsrControl,  PORT_READ },
+    { 0xC00, 4,     &lcd.crsrControl,  PORT_WRITE },
+    { 0xC04, 1,     &lcd.crsrConfig,   PORT_READ },
+    { 0xC08, 4,     &lcd.crsrPalette0, PORT_READ | PORT_WRITE },
+    { 0xC0C, 4,     &lcd.crsrPalette1, PORT_READ | PORT_WRITE },
+    { 0xC10, 4,     &lcd.crsrXY,       PORT_READ },
+    { 0xC14, 2,     &lcd.crsrClip,     PORT_READ },
+    { 0xC20, 1,     &lcd.crsrImsc,     PORT_READ },
+    { 0xC28, 1,     &lcd.crsrRis,      PORT_READ },
+    { 0, 0, NULL, 0 }
+};
+
 static uint8_t lcd_read(const uint16_t pio, bool peek) {
-    uint16_t index = pio;
-    uint8_t bit_offset = (index & 3) << 3;
+    uint8_t bit_offset = (pio & 3) << 3;
 
     (void)peek;
 
-    dma.lcd++;
-
-    if (index < 0x200) {
-        if (index < 0x010) { return read8(lcd.timing[index >> 2], bit_offset); }
-        if (index < 0x014 && index >= 0x010) { return read8(lcd.upbase, bit_offset); }
-        if (index < 0x018 && index >= 0x014) { return read8(lcd.lpbase, bit_offset); }
-        if (index < 0x01C && index >= 0x018) { return read8(lcd.control, bit_offset); }
-        if (index < 0x020 && index >= 0x01C) { return read8(lcd.imsc, bit_offset); }
-        if (index < 0x024 && index >= 0x020) { return read8(lcd.ris, bit_offset); }
-        if (index < 0x028 && index >= 0x024) { return read8(lcd.imsc & lcd.ris, bit_offset); }
-    } else if (index < 0x400) {
-        return *((uint8_t *)lcd.palette + index - 0x200);
-    } else if (index < 0xC30) {
-        if (index < 0xC00 && index >= 0x800) { return read8(lcd.crsrImage[((pio-0x800) & 0x3FF) >> 2], bit_offset); }
-        if (index == 0xC00) { return read8(lcd.crsrControl, bit_offset); }
-        if (index == 0xC04) { return read8(lcd.crsrConfig, bit_offset); }
-        if (index < 0xC0C && index >= 0xC08) { return read8(lcd.crsrPalette0, bit_offset); }
-        if (index < 0xC10 && index >= 0xC0C) { return read8(lcd.crsrPalette1, bit_offset); }
-        if (index < 0xC14 && index >= 0xC10) { return read8(lcd.crsrXY, bit_offset); }
-        if (index < 0xC16 && index >= 0xC14) { return read8(lcd.crsrClip, bit_offset); }
-        if (index == 0xC20) { return read8(lcd.crsrImsc, bit_offset); }
-        if (index == 0xC28) { return read8(lcd.crsrRis, bit_offset); }
-        if (index == 0xC2C) { return read8(lcd.crsrRis & lcd.crsrImsc, bit_offset); }
-    } else if (index >= 0xFE0) {
+    if (pio < 0x028 && pio >= 0x024) { return read8(lcd.imsc & lcd.ris, bit_offset); }
+    if (pio == 0xC2C) { return read8(lcd.crsrRis & lcd.crsrImsc, bit_offset); }
+    if (pio >= 0xFE0) {
         static const uint8_t id[1][8] = {
             { 0x11, 0x11, 0x14, 0x00, 0x0D, 0xF0, 0x05, 0xB1 }
         };
-        return read8(id[0][(index - 0xFE0) >> 2], bit_offset);
+        return read8(id[0][(pio - 0xFE0) >> 2], bit_offset);
     }
 
     /* Return 0 if bad read */
@@ -217,15 +217,13 @@ static void lcd_write(const uint16_t pio, const uint8_t value, bool poke) {
     (void)poke;
 
     if (index < 0x200) {
-        if (index < 0x010) {
-            write8(lcd.timing[index >> 2], bit_offset, value);
-        } else if (index < 0x014 && index >= 0x010) {
+        if (index == 0x010) {
             write8(lcd.upbase, bit_offset, value);
             if (lcd.upbase & 7) {
                 gui_console_printf("[CEmu] Warning: LCD upper panel base not 8-byte aligned\n");
             }
             lcd.upbase &= ~7U;
-        } else if (index < 0x018 && index >= 0x014) {
+        } else if (index == 0x014) {
             write8(lcd.lpbase, bit_offset, value);
             if (lcd.lpbase & 7) {
                 gui_console_printf("[CEmu] Warning: LCD lower panel base not 8-byte aligned\n");
@@ -247,47 +245,34 @@ static void lcd_write(const uint16_t pio, const uint8_t value, bool poke) {
             lcd.ris &= ~(value << bit_offset);
             intrpt_set(INT_LCD, lcd.ris & lcd.imsc);
         }
-    } else if (index < 0x400) {
-        write8(lcd.palette[pio >> 1 & 0xFF], (pio & 1) << 3, value);
-    } else if (index < 0xC30) {
-        if (index < 0xC00 && index >= 0x800) {
-            write8(lcd.crsrImage[((pio-0x800) & 0x3FF) >> 2], bit_offset, value);
-        }
-        if (index == 0xC00) {
-            write8(lcd.crsrControl, bit_offset, value);
-        }
-        if (index == 0xC04) {
-            write8(lcd.crsrConfig, bit_offset, value);
-            lcd.crsrConfig &= 0xF;
-        }
-        if (index < 0xC0B && index >= 0xC08) {
-            write8(lcd.crsrPalette0, bit_offset, value);
-        }
-        if (index < 0xC0F && index >= 0xC0C) {
-            write8(lcd.crsrPalette1, bit_offset, value);
-        }
-        if (index < 0xC14 && index >= 0xC10) {
-            write8(lcd.crsrXY, bit_offset, value);
-            lcd.crsrXY &= (0xFFF | (0xFFF << 16));
-        }
-        if (index < 0xC16 && index >= 0xC14) {
-            write8(lcd.crsrClip, bit_offset, value);
-            lcd.crsrClip &= (0x3F | (0x3F << 8));
-        }
-        if (index == 0xC20) {
-            write8(lcd.crsrImsc, bit_offset, value);
-            lcd.crsrImsc &= 0xF;
-        }
-        if (index == 0xC24) {
-            lcd.crsrRis &= ~(value << bit_offset);
-            lcd.crsrRis &= 0xF;
-        }
+    } else if (index == 0xC04) {
+        write8(lcd.crsrConfig, bit_offset, value);
+        lcd.crsrConfig &= 0xF;
+    } else if (index == 0xC10) {
+        write8(lcd.crsrXY, bit_offset, value);
+        lcd.crsrXY &= (0xFFF | (0xFFF << 16));
+    } else if (index == 0xC14) {
+        write8(lcd.crsrClip, bit_offset, value);
+        lcd.crsrClip &= (0x3F | (0x3F << 8));
+    } else if (index == 0xC20) {
+        write8(lcd.crsrImsc, bit_offset, value);
+        lcd.crsrImsc &= 0xF;
+    } else if (index == 0xC24) {
+        lcd.crsrRis &= ~(value << bit_offset);
+        lcd.crsrRis &= 0xF;
     }
 }
 
+/* Counts table served reads as well as handled ones */
+static void lcd_read_hook(void) {
+    dma.lcd++;
+}
+
 static const eZ80portrange_t device = {
     .read_in    = lcd_read,
-    .write_out  = lcd_write
+    .write_out  = lcd_write,
+    .regs       = regs,
+    .read_hook  = lcd_read_hook
 };
 
 eZ80portrange_t init_lcd(void) {
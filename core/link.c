@@ -10,6 +10,7 @@ volatile bool isSending = false;
 volatile bool isReceiving = false;
 
 #define SAFE_RAM 0xD052C6
+#define OP1      0xD005F8
 
 static const uint8_t jforcegraph[9] = {
     0xF3,                         /* di                            */
@@ -50,12 +51,16 @@ static const uint8_t pgrm_loader[34] = {
     0x18, 0xFE                    /* _sink: jr _sink      */
 };
 
+static bool link_closed(void) {
+    return !isSending && !isReceiving;
+}
+
 void enterVariableLink(void) {
     /* Wait for the GUI to finish whatever it needs to do */
     gui_entered_send_state(true);
-    do {
-        gui_emu_sleep(50);
-    } while (isSending || isReceiving);
+    while (isSending || isReceiving) {
+        gui_emu_wait(link_closed);
+    }
 }
 
 bool listVariablesLink(void) {
@@ -74,9 +79,9 @@ bool listVariablesLink(void) {
 static void run_asm(const uint8_t *data, const size_t data_size, const uint32_t cycles) {
     cpu.halted = cpu.IEF_wait = cpu.IEF1 = cpu.IEF2 = 0;
     memcpy(phys_mem_ptr(SAFE_RAM, 8400), data, data_size);
+    mem_dirty_range(SAFE_RAM, data_size);
     cpu_flush(SAFE_RAM, 1);
-    cpu.cycles = 0;
-    cpu.next = cycles;
+    cpu.next = cpu.cycles + cycles;
     cpu_execute();
 }
 
@@ -93,15 +98,14 @@ bool EMSCRIPTEN_KEEPALIVE sendVariableLink(const char *file_name, unsigned locat
     FILE *file;
     uint8_t tmp_buf[0x80];
 
-    uint32_t save_cycles,
-             save_next,
-             save_cycles_offset;
+    uint64_t save_cycles,
+             save_next;
 
     uint8_t var_ver,
             var_arc;
 
     uint8_t *cxCurApp     = phys_mem_ptr(0xD007E0, 1),
-            *op1          = phys_mem_ptr(0xD005F8, 9),
+            *op1          = phys_mem_ptr(OP1, 9),
             *var_ptr;
 
     uint16_t var_size,
@@ -119,7 +123,6 @@ bool EMSCRIPTEN_KEEPALIVE sendVariableLink(const char *file_name, unsigned locat
 
     save_cycles = cpu.cycles;
     save_next = cpu.next;
-    save_cycles_offset = cpu.cycles_offset;
 
     if (fread(tmp_buf, 1, h_size, file) != h_size)         goto r_err;
     if (memcmp(tmp_buf, header_data, h_size))              goto r_err;
@@ -138,8 +141,8 @@ bool EMSCRIPTEN_KEEPALIVE sendVariableLink(const char *file_name, unsigned locat
         intrpt_set(INT_ON, true);
         control.readBatteryStatus = ~1;
         intrpt_pulse(INT_WAKE);
-        cpu.cycles = cpu.IEF_wait = 0;
-        cpu.next = 100000000;
+        cpu.IEF_wait = 0;
+        cpu.next = cpu.cycles + 100000000;
         cpu_execute();
         intrpt_set(INT_ON, false);
         goto r_err;
@@ -154,6 +157,7 @@ bool EMSCRIPTEN_KEEPALIVE sendVariableLink(const char *file_name, unsigned locat
         if (fread(&header_size, 2, 1, file) != 1)          goto r_err;
         if (fread(&var_size, 2, 1, file) != 1)             goto r_err;
         if (fread(op1, 1, 9, file) != 9)                   goto r_err;
+        mem_dirty_range(OP1, 9);
         if (header_size == 11) {
             var_ver = var_arc = 0;
         } else if (header_size == 13) {
@@ -185,6 +189,7 @@ bool EMSCRIPTEN_KEEPALIVE sendVariableLink(const char *file_name, unsigned locat
         var_ptr = phys_mem_ptr(mem_peek_long(SAFE_RAM), var_size);
 
         if (fread(var_ptr, 1, var_size, file) != var_size) goto r_err;
+        mem_dirty_range(mem_peek_long(SAFE_RAM), var_size);
 
         switch (location) {
             case LINK_FILE:
@@ -202,14 +207,12 @@ bool EMSCRIPTEN_KEEPALIVE sendVariableLink(const char *file_name, unsigned locat
     run_asm(jforcehome, sizeof(jforcehome), 23000000);
     cpu.cycles = save_cycles;
     cpu.next = save_next;
-    cpu.cycles_offset = save_cycles_offset;
 
     return !fclose(file);
 
 r_err:
     cpu.cycles = save_cycles;
     cpu.next = save_next;
-    cpu.cycles_offset = save_cycles_offset;
     fclose(file);
     return false;
 }
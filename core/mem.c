@@ -1,5 +1,8 @@
 #include <string.h>
 #include <assert.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include "mem.h"
 #include "emu.h"
@@ -7,6 +10,7 @@
 #include "dma.h"
 #include "flash.h"
 #include "control.h"
+#include "os/os.h"
 #include "debug/debug.h"
 
 #define mmio_mapped(addr, select) ((addr) < (((select) = (addr) >> 6 & 0x4000) ? 0xFB0000 : 0xE40000))
@@ -15,6 +19,103 @@
 /* Global MEMORY state */
 mem_state_t mem;
 
+/* Set when the flash is a private mapping of the rom file */
+static bool flash_mapped_file;
+
+/* Cycles for cpu accesses to each 64KB page */
+static mem_costs_t costs;
+
+/* Cpu memory map, one entry per 64KB page. Plain memory is accessed through
+ * host pointers, everything else through the handlers of its region. The guard
+ * range covers the addresses of a direct page that still need the handlers,
+ * like the protected range, the stack limit and the end of ram. */
+typedef struct mem_page {
+    uint8_t *read;          /* direct reads, or NULL to use the handler  */
+    uint8_t *write;         /* direct writes, or NULL to use the handler */
+    uint32_t guard_start;
+    uint32_t guard_size;
+    uint8_t (*read_handler)(uint32_t addr, bool debug);
+    void (*write_handler)(uint32_t addr, uint8_t value, bool debug);
+    bool ram;               /* accesses contend with lcd dma            */
+    uint16_t dirty;         /* dirty page of the first 4KB              */
+} mem_page_t;
+
+#define mem_page_direct(page, addr) ((addr) - (page)->guard_start >= (page)->guard_size)
+
+static mem_page_t pages[0x100];
+
+/* Flash pages followed by ram pages, ram starts on a word boundary. Writers only
+ * pay for the atomic or the first time they touch a page after it was taken. */
+#define DIRTY_RAM_PAGE MEM_DIRTY_FLASH_PAGES
+#define DIRTY_WORDS (sizeof(mem_dirty_t) / sizeof(uint32_t))
+
+/* Atomics on the dirty words, as compiler builtins since msvc has no C11 atomics */
+#if defined(_MSC_VER)
+#define dirty_load(p)        (*(volatile long*)(p))
+#define dirty_or(p, v)       _InterlockedOr((volatile long*)(p), (long)(v))
+#define dirty_exchange(p, v) ((uint32_t)_InterlockedExchange((volatile long*)(p), (long)(v)))
+#elif defined(__GNUC__)
+#define dirty_load(p)        __atomic_load_n(p, __ATOMIC_RELAXED)
+#define dirty_or(p, v)       __atomic_fetch_or(p, v, __ATOMIC_RELEASE)
+#define dirty_exchange(p, v) __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL)
+#elif !defined(NO_DIRTY_TRACKING)
+#define NO_DIRTY_TRACKING
+#endif
+
+#ifndef NO_DIRTY_TRACKING
+static uint32_t dirtyPages[DIRTY_WORDS];
+
+static inline void mem_dirty_mark(uint32_t page) {
+    uint32_t *word = &dirtyPages[page >> 5];
+    uint32_t bit = 1u << (page & 31);
+    if (!(dirty_load(word) & bit)) {
+        dirty_or(word, bit);
+    }
+}
+#else
+#define mem_dirty_mark(page) ((void)(page))
+#endif
+
+static void mem_dirty_pages(uint32_t page, uint32_t count) {
+    while (count--) {
+        mem_dirty_mark(page++);
+    }
+}
+
+void mem_dirty_all(void) {
+#ifndef NO_DIRTY_TRACKING
+    unsigned int i;
+    for (i = 0; i < DIRTY_WORDS; i++) {
+        dirty_exchange(&dirtyPages[i], ~0u);
+    }
+#endif
+}
+
+void mem_dirty_range(uint32_t addr, uint32_t size) {
+    uint32_t end = addr + size;
+    for (addr &= ~(MEM_DIRTY_PAGE_SIZE - 1); addr < end && addr < 0xE00000; addr += MEM_DIRTY_PAGE_SIZE) {
+        if (addr < 0xD00000) {
+            mem_dirty_mark((addr & flash.mask) / MEM_DIRTY_PAGE_SIZE);
+        } else if ((addr & 0x7FFFF) < ram_size) {
+            mem_dirty_mark(DIRTY_RAM_PAGE + (addr & 0x7FFFF) / MEM_DIRTY_PAGE_SIZE);
+        }
+    }
+}
+
+void mem_dirty_take(mem_dirty_t *dirty) {
+#ifndef NO_DIRTY_TRACKING
+    unsigned int i;
+    for (i = 0; i < sizeof dirty->flash / sizeof *dirty->flash; i++) {
+        dirty->flash[i] = dirty_exchange(&dirtyPages[i], 0);
+    }
+    for (i = 0; i < sizeof dirty->ram / sizeof *dirty->ram; i++) {
+        dirty->ram[i] = dirty_exchange(&dirtyPages[DIRTY_RAM_PAGE / 32 + i], 0);
+    }
+#else
+    memset(dirty, 0xFF, sizeof *dirty);
+#endif
+}
+
 void mem_init(void) {
     unsigned int i;
 
@@ -40,8 +141,9 @@ void mem_init(void) {
     /* Allocate RAM */
     mem.ram.block = (uint8_t*)calloc(ram_size, sizeof(uint8_t));
 
-    mem.flash.write_index = 0;
+    mem.flash.sequence = 0;
     mem.flash.command = NO_COMMAND;
+    mem_dirty_all();
     gui_console_printf("[CEmu] Initialized Memory...\n");
 }
 
@@ -51,12 +153,45 @@ void mem_free(void) {
         mem.ram.block = NULL;
     }
     if (mem.flash.block) {
-        free(mem.flash.block);
+        if (flash_mapped_file) {
+            unmap_file(mem.flash.block, flash_size);
+        } else {
+            free(mem.flash.block);
+        }
         mem.flash.block = NULL;
     }
+    flash_mapped_file = false;
     gui_console_printf("[CEmu] Freed Memory.\n");
 }
 
+bool mem_map_flash(const char *file) {
+    unsigned int i;
+    uint8_t *block = map_file_private(file, flash_size);
+
+    if (!block) {
+        return false;
+    }
+    if (flash_mapped_file) {
+        unmap_file(mem.flash.block, flash_size);
+    } else {
+        free(mem.flash.block);
+    }
+    mem.flash.block = block;
+    flash_mapped_file = true;
+
+    for (i = 0; i < 8; i++) {
+        mem.flash.sector_8k[i].ptr = mem.flash.block + (i*flash_sector_size_8K);
+    }
+    for (i = 0; i < 64; i++) {
+        mem.flash.sector[i].ptr = mem.flash.block + (i*flash_sector_size_64K);
+    }
+    mem_update_map();
+    mem_dirty_all();
+    cpu_decode_flush();
+    gui_console_printf("[CEmu] Mapped ROM as Flash...\n");
+    return true;
+}
+
 static uint32_t flash_block(uint32_t *addr, uint32_t *size) {
     uint32_t mask = flash.mask;
     if (size) {
@@ -107,28 +242,82 @@ uint8_t *phys_mem_ptr(uint32_t addr, int32_t size) {
     return NULL;
 }
 
+bool mem_span_next(mem_span_t *span, uint32_t *addr, uint32_t *size) {
+    uint32_t start = *addr & 0xFFFFFF;
+    uint32_t offset = start, end, limit;
+    uint8_t *block = NULL;
+
+    if (!*size) {
+        return false;
+    }
+
+    /* end is where the block stops being contiguous, limit where the region stops */
+    if (start < 0xD00000) {
+        span->kind = MEM_SPAN_FLASH;
+        flash_block(&offset, &end);
+        block = mem.flash.block;
+        limit = 0xD00000;
+    } else if (start < 0xE00000) {
+        span->kind = MEM_SPAN_RAM;
+        offset -= 0xD00000;
+        end = ram_size;
+        block = mem.ram.block;
+        limit = 0xE00000;
+    } else if (start - 0xE30200 < sizeof lcd.palette) {
+        span->kind = MEM_SPAN_PALETTE;
+        offset -= 0xE30200;
+        end = sizeof lcd.palette;
+        block = (uint8_t *)lcd.palette;
+        limit = 0xE30200 + sizeof lcd.palette;
+    } else if (start - 0xE30800 < sizeof lcd.crsrImage) {
+        span->kind = MEM_SPAN_CURSOR;
+        offset -= 0xE30800;
+        end = sizeof lcd.crsrImage;
+        block = (uint8_t *)lcd.crsrImage;
+        limit = 0xE30800 + sizeof lcd.crsrImage;
+    } else {
+        span->kind = MEM_SPAN_MMIO;
+        limit = start < 0xE30200 ? 0xE30200 :
+                start < 0xE30800 ? 0xE30800 : 0x1000000;
+    }
+
+    if (block && offset < end) {
+        span->ptr = block + offset;
+        end = end - offset;
+    } else {
+        span->kind = MEM_SPAN_MMIO;
+        span->ptr = NULL;
+        end = limit - start;
+    }
+    if (end > limit - start) {
+        end = limit - start;
+    }
+    span->addr = start;
+    span->size = end < *size ? end : *size;
+    *addr = start + span->size;
+    *size -= span->size;
+    return true;
+}
+
 uint8_t *virt_mem_cpy(uint8_t *dest, uint32_t addr, int32_t size) {
     uint8_t *save_dest;
-    void *block;
-    uint32_t temp_addr, block_size, end_addr;
+    uint32_t remaining, i;
+    mem_span_t span;
     fix_size(&addr, &size);
     if (!dest) {
         dest = malloc(size);
     }
     save_dest = dest;
-    while (size) {
-        temp_addr = addr;
-        end_addr = addr_block(&temp_addr, size, &block, &block_size);
-        if (temp_addr <= end_addr && temp_addr < block_size && block) {
-            uint32_t temp_size = (end_addr <= block_size ? end_addr : block_size) - temp_addr;
-            memcpy(dest, (uint8_t *)block + temp_addr, temp_size);
-            dest += temp_size;
-            addr += temp_size;
-            size -= temp_size;
+    remaining = size;
+    while (mem_span_next(&span, &addr, &remaining)) {
+        if (span.ptr) {
+            memcpy(dest, span.ptr, span.size);
         } else {
-            *dest++ = mem_peek_byte(addr++);
-            size--;
+            for (i = 0; i < span.size; i++) {
+                dest[i] = mem_peek_byte(span.addr + i);
+            }
         }
+        dest += span.size;
     }
     return save_dest;
 }
@@ -137,23 +326,30 @@ uint8_t *virt_mem_dup(uint32_t addr, int32_t size) {
     return virt_mem_cpy(NULL, addr, size);
 }
 
-static void flash_reset_write_index(uint32_t addr, uint8_t byte) {
-    (void)addr;
-    (void)byte;
-    mem.flash.write_index = 0;
+static void flash_set_command(uint8_t command) {
+    if (mem.flash.command != command) {
+        mem.flash.command = command;
+        /* reads only come straight from flash without a command */
+        cpu_fetch_invalidate();
+        mem_update_map();
+    }
 }
 
 static void flash_write(uint32_t addr, uint8_t byte) {
     mem.flash.block[addr] &= byte;
+    mem_dirty_mark(addr / MEM_DIRTY_PAGE_SIZE);
+    cpu_decode_invalidate(addr);
 }
 
 static void flash_erase(uint32_t addr, uint8_t byte) {
     (void)addr;
     (void)byte;
 
-    mem.flash.command = FLASH_CHIP_ERASE;
+    flash_set_command(FLASH_CHIP_ERASE);
 
     memset(mem.flash.block, 0xFF, flash_size);
+    mem_dirty_pages(0, MEM_DIRTY_FLASH_PAGES);
+    cpu_decode_flush();
     gui_console_printf("[CEmu] Erased Flash chip.\n");
 }
 
@@ -161,11 +357,13 @@ static void flash_erase_sector(uint32_t addr, uint8_t byte) {
     uint8_t selected;
     (void)byte;
 
-    mem.flash.command = FLASH_SECTOR_ERASE;
+    flash_set_command(FLASH_SECTOR_ERASE);
     selected = addr/flash_sector_size_64K;
 
     if (!mem.flash.sector[selected].locked) {
         memset(mem.flash.sector[selected].ptr, 0xFF, flash_sector_size_64K);
+        mem_dirty_pages(selected * (flash_sector_size_64K / MEM_DIRTY_PAGE_SIZE), flash_sector_size_64K / MEM_DIRTY_PAGE_SIZE);
+        cpu_decode_flush();
     }
 }
 
@@ -173,121 +371,75 @@ static void flash_verify_sector_protection(uint32_t addr, uint8_t byte) {
     (void)addr;
     (void)byte;
 
-    mem.flash.command = FLASH_READ_SECTOR_PROTECTION;
+    flash_set_command(FLASH_READ_SECTOR_PROTECTION);
 }
 
 static void flash_cfi_read(uint32_t addr, uint8_t byte) {
     (void)addr;
     (void)byte;
 
-    mem.flash.command = FLASH_READ_CFI;
+    flash_set_command(FLASH_READ_CFI);
 }
 
 static void flash_enter_deep_power_down(uint32_t addr, uint8_t byte) {
     (void)addr;
     (void)byte;
 
-    mem.flash.command = FLASH_DEEP_POWER_DOWN;
+    flash_set_command(FLASH_DEEP_POWER_DOWN);
 }
 
 static void flash_enter_IPB(uint32_t addr, uint8_t byte) {
     (void)addr;
     (void)byte;
 
-    mem.flash.command = FLASH_IPB_MODE;
+    flash_set_command(FLASH_IPB_MODE);
 }
 
-typedef const struct flash_write_pattern {
-    const int length;
-    const flash_write_t pattern[6];
-    void (*const handler)(uint32_t addr, uint8_t value);
-} flash_write_pattern_t;
-
-typedef struct flash_status_pattern {
-    uint8_t length;
-    uint8_t pattern[10];
-} flash_status_pattern_t;
-
-static flash_write_pattern_t patterns[] = {
-    {
-        .length = 4,
-        .pattern = {
-            { .addr = 0xAAA, .addr_mask = 0xFFF, .value = 0xAA, .value_mask = 0xFF },
-            { .addr = 0x555, .addr_mask = 0xFFF, .value = 0x55, .value_mask = 0xFF },
-            { .addr = 0xAAA, .addr_mask = 0xFFF, .value = 0xA0, .value_mask = 0xFF },
-            { .addr = 0x000, .addr_mask = 0x000, .value = 0x00, .value_mask = 0x00 },
-        },
-        .handler = flash_write
-    },
-    {
-        .length = 6,
-        .pattern = {
-            { .addr = 0xAAA, .addr_mask = 0xFFF, .value = 0xAA, .value_mask = 0xFF },
-            { .addr = 0x555, .addr_mask = 0xFFF, .value = 0x55, .value_mask = 0xFF },
-            { .addr = 0xAAA, .addr_mask = 0xFFF, .value = 0x80, .value_mask = 0xFF },
-            { .addr = 0xAAA, .addr_mask = 0xFFF, .value = 0xAA, .value_mask = 0xFF },
-            { .addr = 0x555, .addr_mask = 0xFFF, .value = 0x55, .value_mask = 0xFF },
-            { .addr = 0x000, .addr_mask = 0x000, .value = 0x30, .value_mask = 0xFF },
-        },
-        .handler = flash_erase_sector
-    },
-    {
-        .length = 6,
-        .pattern = {
-            { .addr = 0xAAA, .addr_mask = 0xFFF, .value = 0xAA, .value_mask = 0xFF },
-            { .addr = 0x555, .addr_mask = 0xFFF, .value = 0x55, .value_mask = 0xFF },
-            { .addr = 0xAAA, .addr_mask = 0xFFF, .value = 0x80, .value_mask = 0xFF },
-            { .addr = 0xAAA, .addr_mask = 0xFFF, .value = 0xAA, .value_mask = 0xFF },
-            { .addr = 0x555, .addr_mask = 0xFFF, .value = 0x55, .value_mask = 0xFF },
-            { .addr = 0xAAA, .addr_mask = 0xFFF, .value = 0x10, .value_mask = 0xFF },
-        },
-        .handler = flash_erase
-    },
-    {
-        .length = 1,
-        .pattern = {
-            { .addr = 0xAA, .addr_mask = 0xFFF, .value = 0x98, .value_mask = 0xFF },
-        },
-        .handler = flash_cfi_read
-    },
-    {
-        .length = 3,
-        .pattern = {
-            { .addr = 0xAAA, .addr_mask = 0xFFF, .value = 0xAA, .value_mask = 0xFF },
-            { .addr = 0x555, .addr_mask = 0xFFF, .value = 0x55, .value_mask = 0xFF },
-            { .addr = 0xAAA, .addr_mask = 0xFFF, .value = 0x90, .value_mask = 0xFF },
-        },
-        .handler = flash_verify_sector_protection
-    },
-    {
-        .length = 3,
-        .pattern = {
-            { .addr = 0xAAA, .addr_mask = 0xFFF, .value = 0xAA, .value_mask = 0xFF },
-            { .addr = 0x555, .addr_mask = 0xFFF, .value = 0x55, .value_mask = 0xFF },
-            { .addr = 0x000, .addr_mask = 0x000, .value = 0xB9, .value_mask = 0xFF },
-        },
-        .handler = flash_enter_deep_power_down
-    },
-    {
-        .length = 3,
-        .pattern = {
-            { .addr = 0xAAA, .addr_mask = 0xFFF, .value = 0xAA, .value_mask = 0xFF },
-            { .addr = 0x555, .addr_mask = 0xFFF, .value = 0x55, .value_mask = 0xFF },
-            { .addr = 0xAAA, .addr_mask = 0xFFF, .value = 0xC0, .value_mask = 0xFF },
-        },
-        .handler = flash_enter_IPB
-    },
-    {
-        .length = 0
-    }
+/* Flash command decoder
+ * Each state is a prefix of the unlock and command sequences. A write that
+ * matches a transition of the current state moves on to the next state,
+ * completing the command if there is a handler, anything else starts over. */
+enum {
+    FLASH_SEQ_START,
+    FLASH_SEQ_UNLOCKED,         /* AAA:AA                         */
+    FLASH_SEQ_UNLOCKED2,        /* AAA:AA 555:55                  */
+    FLASH_SEQ_PROGRAM,          /* AAA:AA 555:55 AAA:A0           */
+    FLASH_SEQ_ERASE,            /* AAA:AA 555:55 AAA:80           */
+    FLASH_SEQ_ERASE_UNLOCKED,   /* AAA:AA 555:55 AAA:80 AAA:AA    */
+    FLASH_SEQ_ERASE_UNLOCKED2,  /* AAA:AA 555:55 AAA:80 AAA:AA 555:55 */
+};
+
+#define FLASH_SEQ_ANY 0xFFFF
 
+typedef const struct flash_transition {
+    uint8_t state;
+    uint16_t addr;              /* low 12 bits of the address, or FLASH_SEQ_ANY */
+    uint16_t value;             /* byte written, or FLASH_SEQ_ANY */
+    uint8_t next;
+    void (*const handler)(uint32_t addr, uint8_t value);
+} flash_transition_t;
+
+static flash_transition_t transitions[] = {
+    { FLASH_SEQ_START,           0x0AA,         0x98,          FLASH_SEQ_START,           flash_cfi_read                 },
+    { FLASH_SEQ_START,           0xAAA,         0xAA,          FLASH_SEQ_UNLOCKED,        NULL                           },
+    { FLASH_SEQ_UNLOCKED,        0x555,         0x55,          FLASH_SEQ_UNLOCKED2,       NULL                           },
+    { FLASH_SEQ_UNLOCKED2,       0xAAA,         0xA0,          FLASH_SEQ_PROGRAM,         NULL                           },
+    { FLASH_SEQ_UNLOCKED2,       0xAAA,         0x80,          FLASH_SEQ_ERASE,           NULL                           },
+    { FLASH_SEQ_UNLOCKED2,       0xAAA,         0x90,          FLASH_SEQ_START,           flash_verify_sector_protection },
+    { FLASH_SEQ_UNLOCKED2,       FLASH_SEQ_ANY, 0xB9,          FLASH_SEQ_START,           flash_enter_deep_power_down    },
+    { FLASH_SEQ_UNLOCKED2,       0xAAA,         0xC0,          FLASH_SEQ_START,           flash_enter_IPB                },
+    { FLASH_SEQ_PROGRAM,         FLASH_SEQ_ANY, FLASH_SEQ_ANY, FLASH_SEQ_START,           flash_write                    },
+    { FLASH_SEQ_ERASE,           0xAAA,         0xAA,          FLASH_SEQ_ERASE_UNLOCKED,  NULL                           },
+    { FLASH_SEQ_ERASE_UNLOCKED,  0x555,         0x55,          FLASH_SEQ_ERASE_UNLOCKED2, NULL                           },
+    { FLASH_SEQ_ERASE_UNLOCKED2, FLASH_SEQ_ANY, 0x30,          FLASH_SEQ_START,           flash_erase_sector             },
+    { FLASH_SEQ_ERASE_UNLOCKED2, 0xAAA,         0x10,          FLASH_SEQ_START,           flash_erase                    },
 };
 
 static uint8_t flash_read_handler(uint32_t addr) {
     uint8_t value = 0;
     uint8_t selected;
 
-    cpu.cycles += flash_block(&addr, NULL);
+    flash_block(&addr, NULL);
     if (flash.mapped) {
         switch(mem.flash.command) {
             case NO_COMMAND:
@@ -300,12 +452,12 @@ static uint8_t flash_read_handler(uint32_t addr) {
                     /* Simulate erase delay */
                     gui_emu_sleep(1.5e4);
                     mem.flash.read_index = 0;
-                    mem.flash.command = NO_COMMAND;
+                    flash_set_command(NO_COMMAND);
                 }
                 break;
             case FLASH_CHIP_ERASE:
                 value = 0xFF;
-                mem.flash.command = NO_COMMAND;
+                flash_set_command(NO_COMMAND);
                 break;
             case FLASH_READ_SECTOR_PROTECTION:
                 if (addr < 0x10000) {
@@ -344,12 +496,11 @@ static uint8_t flash_read_handler(uint32_t addr) {
 }
 
 static void flash_write_handler(uint32_t addr, uint8_t byte) {
-    int i;
-    int partial_match = 0;
-    flash_write_t *w;
-    flash_write_pattern_t *pattern;
+    flash_transition_t *transition;
+    uint8_t state;
 
-    cpu.cycles += flash_block(&addr, NULL);
+    cpu.cycles += costs.write[addr >> 16];
+    flash_block(&addr, NULL);
     if (!flash.mapped) {
         return;
     }
@@ -358,91 +509,236 @@ static void flash_write_handler(uint32_t addr, uint8_t byte) {
     if (mem.flash.command != NO_COMMAND) {
         if ((mem.flash.command != FLASH_DEEP_POWER_DOWN && byte == 0xF0) ||
             (mem.flash.command == FLASH_DEEP_POWER_DOWN && byte == 0xAB)) {
-            mem.flash.command = NO_COMMAND;
-            flash_reset_write_index(addr, byte);
+            flash_set_command(NO_COMMAND);
+            mem.flash.sequence = FLASH_SEQ_START;
             return;
         }
     }
 
-    w = &mem.flash.writes[mem.flash.write_index++];
-    w->addr = addr;
-    w->value = byte;
-
-    for (pattern = patterns; pattern->length; pattern++) {
-        for (i = 0; (i < mem.flash.write_index) && (i < pattern->length) &&
-            (mem.flash.writes[i].addr & pattern->pattern[i].addr_mask) == pattern->pattern[i].addr &&
-            (mem.flash.writes[i].value & pattern->pattern[i].value_mask) == pattern->pattern[i].value; i++) {
-        }
-        if (i == pattern->length) {
-            pattern->handler(addr, byte);
-            partial_match = 0;
+    state = mem.flash.sequence;
+    mem.flash.sequence = FLASH_SEQ_START;
+    for (transition = transitions; transition < transitions + sizeof transitions / sizeof *transitions; transition++) {
+        if (transition->state == state &&
+            (transition->addr == FLASH_SEQ_ANY || transition->addr == (addr & 0xFFF)) &&
+            (transition->value == FLASH_SEQ_ANY || transition->value == byte)) {
+            mem.flash.sequence = transition->next;
+            if (transition->handler) {
+                transition->handler(addr, byte);
+            }
             break;
-        } else if (i == mem.flash.write_index) {
-            partial_match = 1;
         }
     }
-    if (!partial_match) {
-        flash_reset_write_index(addr, byte);
+}
+
+/* Debug builds also get a lean copy of the cpu accessors, where the debug argument is false */
+#ifdef DEBUG_SUPPORT
+#define mem_port_read(debug, port)         ((debug) ? port_read_byte(port) : port_read_byte_lean(port))
+#define mem_port_write(debug, port, value) ((debug) ? port_write_byte(port, value) : port_write_byte_lean(port, value))
+#else
+#define mem_port_read(debug, port)         ((void)(debug), port_read_byte(port))
+#define mem_port_write(debug, port, value) ((void)(debug), port_write_byte(port, value))
+#endif
+
+/* FLASH */
+static uint8_t mem_read_flash(uint32_t addr, bool debug) {
+    (void)debug;
+    return flash_read_handler(addr);
+}
+
+static void mem_write_flash(uint32_t addr, uint8_t value, bool debug) {
+    (void)debug;
+    if (unprivileged_code()) {
+        control.protectionStatus |= 2;
+        gui_console_printf("[CEmu] NMI reset cause by write to flash at address %#06x from unprivileged code. Hint: Possibly a null pointer dereference.\n", addr);
+        cpu_nmi();
+    } else if (!mem.flash.locked) {
+        flash_write_handler(addr, value);
+    } // privileged writes with flash locked are probably ignored
+}
+
+/* UNMAPPED */
+static uint8_t mem_read_unmapped(uint32_t addr, bool debug) {
+    (void)addr;
+    (void)debug;
+    return 0;
+}
+
+static void mem_write_unmapped(uint32_t addr, uint8_t value, bool debug) {
+    (void)value;
+    (void)debug;
+    cpu.cycles += costs.write[addr >> 16];
+}
+
+/* RAM */
+static uint8_t mem_read_ram(uint32_t addr, bool debug) {
+    uint32_t ramAddr = addr & 0x7FFFF;
+    (void)debug;
+    dma.ram++;
+    return ramAddr < ram_size ? mem.ram.block[ramAddr] : 0;
+}
+
+static void mem_write_ram(uint32_t addr, uint8_t value, bool debug) {
+    uint32_t ramAddr = addr & 0x7FFFF;
+    (void)debug;
+    cpu.cycles += costs.write[addr >> 16];
+    dma.ram++;
+    if (ramAddr < ram_size) {
+        mem.ram.block[ramAddr] = value;
+        mem_dirty_mark(DIRTY_RAM_PAGE + ramAddr / MEM_DIRTY_PAGE_SIZE);
+        cpu_decode_invalidate(addr);
     }
 }
 
-uint8_t mem_read_cpu(uint32_t addr, bool fetch) {
-    static const uint8_t mmio_readcycles[0x20] = {2,2,4,3,2,2,2,2,2,2,2,2,2,2,2,2, 3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,2};
-    uint8_t value = 0;
-    uint32_t ramAddr, select;
+/* MMIO <-> Advanced Perphrial Bus */
+static uint8_t mem_read_mmio(uint32_t addr, bool debug) {
+    uint32_t select;
+    if (mmio_mapped(addr, select)) {
+        return mem_port_read(debug, mmio_port(addr, select));
+    }
+    return 0;
+}
 
-    addr &= 0xFFFFFF;
+static void mem_write_mmio(uint32_t addr, uint8_t value, bool debug) {
+    uint32_t select;
+    cpu.cycles += costs.write[addr >> 16];
 #ifdef DEBUG_SUPPORT
-    if (debugger.data.block[addr] & DBG_READ_WATCHPOINT) {
-        open_debugger(HIT_READ_WATCHPOINT, addr);
+    if (addr >= DBG_PORT_RANGE) {
+        open_debugger(addr, value);
+        return;
+    } else if ((addr >= DBGOUT_PORT_RANGE && addr < DBGOUT_PORT_RANGE+SIZEOF_DBG_BUFFER-1)) {
+        if (value != 0) {
+            debugger.buffer[debugger.currentBuffPos] = (char)value;
+            debugger.currentBuffPos = (debugger.currentBuffPos + 1) % (SIZEOF_DBG_BUFFER);
+        }
+        return;
+    } else if ((addr >= DBGERR_PORT_RANGE && addr < DBGERR_PORT_RANGE+SIZEOF_DBG_BUFFER-1)) {
+        if (value != 0) {
+            debugger.errBuffer[debugger.currentErrBuffPos] = (char)value;
+            debugger.currentErrBuffPos = (debugger.currentErrBuffPos + 1) % (SIZEOF_DBG_BUFFER);
+        }
+        return;
     }
 #endif
-    // reads from protected memory return 0
-    if (!(!fetch && addr >= control.protectedStart && addr <= control.protectedEnd && unprivileged_code())) {
-        switch((addr >> 20) & 0xF) {
-            /* FLASH */
+    if (mmio_mapped(addr, select)) {
+        mem_port_write(debug, mmio_port(addr, select), value);
+    }
+}
+
+void mem_update_map(void) {
+    static const uint8_t mmio_readcycles[0x20] = {2,2,4,3,2,2,2,2,2,2,2,2,2,2,2,2, 3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,2};
+    static const uint8_t mmio_writecycles[0x20] = {2,2,4,2,2,2,2,2,2,2,2,2,2,2,2,2, 3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,2};
+    unsigned int page;
+
+    for (page = 0; page < 0x100; page++) {
+        uint32_t start = page << 16, end = start | 0xFFFF;
+        uint32_t lo = end + 1, hi = start;  /* guard range, empty while lo > hi */
+        mem_page_t *entry = &pages[page];
+
+        if (control.protectedStart <= end && control.protectedEnd >= start) {
+            lo = control.protectedStart > start ? control.protectedStart : start;
+            hi = control.protectedEnd < end ? control.protectedEnd : end;
+        }
+        if (control.stackLimit >= start && control.stackLimit <= end) {
+            lo = control.stackLimit < lo ? control.stackLimit : lo;
+            hi = control.stackLimit > hi ? control.stackLimit : hi;
+        }
+
+        entry->read = entry->write = NULL;
+        entry->ram = false;
+        entry->dirty = 0;
+        switch (page >> 4) {
             case 0x0: case 0x1: case 0x2: case 0x3:
             case 0x4: case 0x5: case 0x6: case 0x7:
-                value = flash_read_handler(addr);
+                costs.read[page] = costs.write[page] = start <= flash.mask && flash.mapped ? 6 + flash.addedWaitStates : 258;
+                entry->read_handler = mem_read_flash;
+                entry->write_handler = mem_write_flash;
+                if (start <= flash.mask && flash.mapped && mem.flash.command == NO_COMMAND) {
+                    entry->read = mem.flash.block + start;
+                }
                 break;
 
-                /* UNMAPPED */
             case 0x8: case 0x9: case 0xA: case 0xB: case 0xC:
-                cpu.cycles += 258;
+                costs.read[page] = costs.write[page] = 258;
+                entry->read_handler = mem_read_unmapped;
+                entry->write_handler = mem_write_unmapped;
                 break;
 
-                /* RAM */
             case 0xD:
-                cpu.cycles += 4;
-                dma.ram++;
-                ramAddr = addr & 0x7FFFF;
-                if (ramAddr < 0x65800) {
-                    value = mem.ram.block[ramAddr];
+                costs.read[page] = 4;
+                costs.write[page] = 2;
+                entry->read_handler = mem_read_ram;
+                entry->write_handler = mem_write_ram;
+                entry->ram = true;
+                if ((start & 0x7FFFF) < ram_size) {
+                    entry->read = entry->write = mem.ram.block + (start & 0x7FFFF);
+                    entry->dirty = DIRTY_RAM_PAGE + (start & 0x7FFFF) / MEM_DIRTY_PAGE_SIZE;
+                    if ((start & 0x7FFFF) + 0x10000 > ram_size) {
+                        lo = start + ram_size - (start & 0x7FFFF) < lo ? start + ram_size - (start & 0x7FFFF) : lo;
+                        hi = end;
+                    }
                 }
                 break;
 
-                /* MMIO <-> Advanced Perphrial Bus */
             case 0xE: case 0xF:
-                cpu.cycles += mmio_readcycles[(addr >> 16) & 0x1F];
-                if (mmio_mapped(addr, select)) {
-                    value = port_read_byte(mmio_port(addr, select));
-                }
+                costs.read[page] = mmio_readcycles[page & 0x1F];
+                costs.write[page] = mmio_writecycles[page & 0x1F];
+                entry->read_handler = mem_read_mmio;
+                entry->write_handler = mem_write_mmio;
                 break;
         }
+        entry->guard_start = lo;
+        entry->guard_size = lo <= hi ? hi - lo + 1 : 0;
     }
-    return value;
 }
 
-void mem_write_cpu(uint32_t addr, uint8_t value) {
-    static const uint8_t mmio_writecycles[0x20] = {2,2,4,2,2,2,2,2,2,2,2,2,2,2,2,2, 3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,2};
-    uint32_t ramAddr, select;
+const mem_costs_t *mem_costs(void) {
+    return &costs;
+}
+
+static inline uint8_t mem_read_cpu_access(uint32_t addr, bool fetch, bool debug) {
+    const mem_page_t *page;
+
     addr &= 0xFFFFFF;
+#ifdef DEBUG_SUPPORT
+    if (debug && debug_map_get(&debugger.data.block, addr) & DBG_READ_WATCHPOINT) {
+        open_debugger(HIT_READ_WATCHPOINT, addr);
+    }
+#endif
+    page = &pages[addr >> 16];
+    if (page->read && mem_page_direct(page, addr)) {
+        cpu.cycles += costs.read[addr >> 16];
+        dma.ram += page->ram;
+        return page->read[addr & 0xFFFF];
+    }
+    // reads from protected memory return 0
+    if (!fetch && addr >= control.protectedStart && addr <= control.protectedEnd && unprivileged_code()) {
+        return 0;
+    }
+    cpu.cycles += costs.read[addr >> 16];
+    return page->read_handler(addr, debug);
+}
 
+static inline void mem_write_cpu_access(uint32_t addr, uint8_t value, bool debug) {
+    const mem_page_t *page;
+
+    addr &= 0xFFFFFF;
 #ifdef DEBUG_SUPPORT
-    if ((debugger.data.block[addr] &= ~(DBG_INST_START_MARKER | DBG_INST_MARKER)) & DBG_WRITE_WATCHPOINT) {
-        open_debugger(HIT_WRITE_WATCHPOINT, addr);
+    if (debug) {
+        debug_map_clear(&debugger.data.markers, addr, DBG_INST_START_MARKER | DBG_INST_MARKER);
+        if (debug_map_get(&debugger.data.block, addr) & DBG_WRITE_WATCHPOINT) {
+            open_debugger(HIT_WRITE_WATCHPOINT, addr);
+        }
     }
 #endif
+    page = &pages[addr >> 16];
+    if (page->write && mem_page_direct(page, addr)) {
+        cpu.cycles += costs.write[addr >> 16];
+        dma.ram++;
+        page->write[addr & 0xFFFF] = value;
+        mem_dirty_mark(page->dirty + (addr >> 12 & 0xF));
+        cpu_decode_invalidate(addr);
+        return;
+    }
 
     if (addr == control.stackLimit) {
         control.protectionStatus |= 1;
@@ -455,68 +751,35 @@ void mem_write_cpu(uint32_t addr, uint8_t value) {
         gui_console_printf("[CEmu] NMI reset caused by writing to protected memory (%#06x through %#06x) at address %#06x from unprivileged code.\n", control.protectedStart, control.protectedEnd, addr);
         cpu_nmi();
     } else { // writes to protected memory are ignored
-        switch((addr >> 20) & 0xF) {
-            /* FLASH */
-            case 0x0: case 0x1: case 0x2: case 0x3:
-            case 0x4: case 0x5: case 0x6: case 0x7:
-                if (unprivileged_code()) {
-                    control.protectionStatus |= 2;
-                    gui_console_printf("[CEmu] NMI reset cause by write to flash at address %#06x from unprivileged code. Hint: Possibly a null pointer dereference.\n", addr);
-                    cpu_nmi();
-                } else if (!mem.flash.locked) {
-                    flash_write_handler(addr, value);
-                } // privileged writes with flash locked are probably ignored
-                break;
+        page->write_handler(addr, value, debug);
+    }
+}
 
-                /* UNMAPPED */
-            case 0x8: case 0x9: case 0xA: case 0xB: case 0xC:
-                cpu.cycles += 258;
-                break;
+uint8_t mem_read_cpu(uint32_t addr, bool fetch) {
+    return mem_read_cpu_access(addr, fetch, true);
+}
 
-                /* RAM */
-            case 0xD:
-                cpu.cycles += 2;
-                dma.ram++;
-                ramAddr = addr & 0x7FFFF;
-                if (ramAddr < 0x65800) {
-                    mem.ram.block[ramAddr] = value;
-                }
-                break;
+void mem_write_cpu(uint32_t addr, uint8_t value) {
+    mem_write_cpu_access(addr, value, true);
+}
 
-                /* MMIO <-> Advanced Perphrial Bus */
-            case 0xE: case 0xF:
-                cpu.cycles += mmio_writecycles[(addr >> 16) & 0x1F];
 #ifdef DEBUG_SUPPORT
-                if (addr >= DBG_PORT_RANGE) {
-                    open_debugger(addr, value);
-                    break;
-                } else if ((addr >= DBGOUT_PORT_RANGE && addr < DBGOUT_PORT_RANGE+SIZEOF_DBG_BUFFER-1)) {
-                    if (value != 0) {
-                        debugger.buffer[debugger.currentBuffPos] = (char)value;
-                        debugger.currentBuffPos = (debugger.currentBuffPos + 1) % (SIZEOF_DBG_BUFFER);
-                    }
-                    break;
-                } else if ((addr >= DBGERR_PORT_RANGE && addr < DBGERR_PORT_RANGE+SIZEOF_DBG_BUFFER-1)) {
-                    if (value != 0) {
-                        debugger.errBuffer[debugger.currentErrBuffPos] = (char)value;
-                        debugger.currentErrBuffPos = (debugger.currentErrBuffPos + 1) % (SIZEOF_DBG_BUFFER);
-                    }
-                    break;
-                }
-#endif
-                if (mmio_mapped(addr, select)) {
-                    port_write_byte(mmio_port(addr, select), value);
-                }
-                break;
-        }
-    }
+uint8_t mem_read_cpu_lean(uint32_t addr, bool fetch) {
+    return mem_read_cpu_access(addr, fetch, false);
+}
+
+void mem_write_cpu_lean(uint32_t addr, uint8_t value) {
+    mem_write_cpu_access(addr, value, false);
 }
+#endif
 
 uint8_t mem_peek_byte(uint32_t addr) {
     uint8_t value = 0;
     uint32_t select;
     addr &= 0xFFFFFF;
-    if (addr < 0xE00000) {
+    if (pages[addr >> 16].read && mem_page_direct(&pages[addr >> 16], addr)) {
+        value = pages[addr >> 16].read[addr & 0xFFFF];
+    } else if (addr < 0xE00000) {
         uint8_t *ptr;
         if ((ptr = phys_mem_ptr(addr, 1))) {
             value = *ptr;
@@ -546,10 +809,17 @@ uint32_t mem_peek_word(uint32_t addr, bool mode) {
 void mem_poke_byte(uint32_t addr, uint8_t value) {
     uint32_t select;
     addr &= 0xFFFFFF;
-    if (addr < 0xE00000) {
+    cpu_idle_invalidate();
+    if (pages[addr >> 16].write && mem_page_direct(&pages[addr >> 16], addr)) {
+        pages[addr >> 16].write[addr & 0xFFFF] = value;
+        mem_dirty_mark(pages[addr >> 16].dirty + (addr >> 12 & 0xF));
+        cpu_decode_invalidate(addr);
+    } else if (addr < 0xE00000) {
         uint8_t *ptr;
         if ((ptr = phys_mem_ptr(addr, 1))) {
             *ptr = value;
+            mem_dirty_range(addr, 1);
+            cpu_decode_invalidate(addr < 0xD00000 ? addr & flash.mask : addr);
         }
     } else if (mmio_mapped(addr, select)) {
         port_poke_byte(mmio_port(addr, select), value);
@@ -588,5 +858,7 @@ bool mem_restore(const emu_image *s) {
     for (i = 0; i < 64; i++) {
         mem.flash.sector[i].ptr = mem.flash.block + (i*flash_sector_size_64K);
     }
+    mem_update_map();
+    mem_dirty_all();
     return true;
 }
@@ -20,13 +20,6 @@ enum flash_commands {
     FLASH_IPB_MODE
 };
 
-typedef struct {
-    uint32_t addr;
-    uint32_t addr_mask;
-    uint8_t value;
-    uint8_t value_mask;
-} flash_write_t;
-
 /* The first 8 sectors are 8K in length */
 /* The other 63 are 64K in length, uniform, for a total of 64 uniform sectors */
 typedef struct {
@@ -36,7 +29,7 @@ typedef struct {
 
 typedef struct {
     bool locked;
-    uint8_t write_index;
+    uint8_t sequence;   /* command decoder state */
     uint8_t read_index;
     flash_sector_state_t sector_8k[8];
     flash_sector_state_t sector[64];
@@ -45,7 +38,6 @@ typedef struct {
 
     /* Internal */
     uint8_t command;
-    flash_write_t writes[6];
 } flash_chip_t;
 
 typedef struct {
@@ -67,11 +59,56 @@ extern mem_state_t mem;
 static const uint32_t flash_sector_size_8K = 0x2000;
 static const uint32_t flash_sector_size_64K = 0x10000;
 
+/* Pages of flash and ram written since the last mem_dirty_take, one bit per 4KB */
+#define MEM_DIRTY_PAGE_SIZE   0x1000
+#define MEM_DIRTY_FLASH_PAGES (flash_size / MEM_DIRTY_PAGE_SIZE)
+#define MEM_DIRTY_RAM_PAGES   ((ram_size + MEM_DIRTY_PAGE_SIZE - 1) / MEM_DIRTY_PAGE_SIZE)
+
+typedef struct {
+    uint32_t flash[MEM_DIRTY_FLASH_PAGES / 32];
+    uint32_t ram[(MEM_DIRTY_RAM_PAGES + 31) / 32];
+} mem_dirty_t;
+
+#define mem_dirty_test(bits, page) ((bits)[(page) >> 5] >> ((page) & 31) & 1)
+
+/* Cycles charged for cpu reads and writes of each 64KB page */
+typedef struct {
+    uint16_t read[0x100];
+    uint16_t write[0x100];
+} mem_costs_t;
+
+/* Contiguous host view of a guest address range */
+typedef enum {
+    MEM_SPAN_FLASH,
+    MEM_SPAN_RAM,
+    MEM_SPAN_PALETTE,
+    MEM_SPAN_CURSOR,
+    MEM_SPAN_MMIO           /* mmio or unmapped, ptr is NULL, read with mem_peek_byte */
+} mem_span_kind_t;
+
+typedef struct {
+    uint8_t *ptr;
+    uint32_t addr;
+    uint32_t size;
+    mem_span_kind_t kind;
+} mem_span_t;
+
 /* Available Functions */
 void mem_init(void);
 void mem_free(void);
 
+/* Maps a rom file copy-on-write as the flash contents, returns false if it can't be mapped */
+bool mem_map_flash(const char *file);
+
+/* Rebuilds the memory map and cost tables, call when the flash mapping,
+ * wait states, flash command or protected ranges change */
+void mem_update_map(void);
+const mem_costs_t *mem_costs(void);
+
 uint8_t *phys_mem_ptr(uint32_t addr, int32_t size);
+/* Gets the span starting at *addr and advances past it, returns false once *size is 0 */
+bool mem_span_next(mem_span_t *span, uint32_t *addr, uint32_t *size);
+/* Copies into buf without allocating, or into a new buffer if buf is NULL */
 uint8_t *virt_mem_cpy(uint8_t *buf, uint32_t addr, int32_t size);
 uint8_t *virt_mem_dup(uint32_t addr, int32_t size);
 uint8_t mem_peek_byte(uint32_t addr);
@@ -80,9 +117,22 @@ uint32_t mem_peek_long(uint32_t addr);
 uint32_t mem_peek_word(uint32_t addr, bool mode);
 void mem_poke_byte(uint32_t addr, uint8_t value);
 
+/* Dirty page tracking, on unless built with -DNO_DIRTY_TRACKING, then every page
+ * reads as dirty. mem_dirty_take copies the bitmap and clears it in one go, a page
+ * written while it runs is in this snapshot or the next. mem_dirty_range marks
+ * guest addresses written without going through the accessors above. */
+void mem_dirty_take(mem_dirty_t *dirty);
+void mem_dirty_range(uint32_t addr, uint32_t size);
+void mem_dirty_all(void);
+
 /* Mateo, do not use! Use the ones above. */
 uint8_t mem_read_cpu(uint32_t address, bool fetch);
 void mem_write_cpu(uint32_t address, uint8_t value);
+#ifdef DEBUG_SUPPORT
+/* Without watchpoints, for the lean cpu core */
+uint8_t mem_read_cpu_lean(uint32_t address, bool fetch);
+void mem_write_cpu_lean(uint32_t address, uint8_t value);
+#endif
 
 /* Save/Restore */
 typedef struct emu_image emu_image;
@@ -22,11 +22,20 @@ FILE *fopen_utf8(const char *filename, const char *mode)
     return fopen(filename, mode);
 }
 
+void *map_file_private(const char *filename, size_t size)
+{
+    return NULL;
+}
+
+void unmap_file(void *ptr, size_t size) {}
+
 void throttle_timer_off() {}
 void throttle_timer_on() {}
-void throttle_timer_wait() {}
+void throttle_timer_wait(uint32_t ticks) { (void)ticks; }
 
 void gui_emu_sleep() { usleep(500); }
+void gui_emu_wait(bool (*ready)(void)) { (void)ready; usleep(500); }
+void gui_emu_wake() {}
 void gui_do_stuff() {}
 void gui_set_busy(bool busy) {}
 
@@ -1,7 +1,27 @@
 #include "os.h"
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 FILE *fopen_utf8(const char *filename, const char *mode)
 {
     return fopen(filename, mode);
 }
+
+void *map_file_private(const char *filename, size_t size)
+{
+    void *ptr;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+void unmap_file(void *ptr, size_t size)
+{
+    munmap(ptr, size);
+}
@@ -12,4 +12,29 @@ FILE *fopen_utf8(const char *filename, const char *mode)
     return _wfopen(filename_w, mode_w);
 }
 
+void *map_file_private(const char *filename, size_t size)
+{
+    wchar_t filename_w[MAX_PATH];
+    HANDLE file, mapping;
+    void *ptr = NULL;
+    MultiByteToWideChar(CP_UTF8, 0, filename, -1, filename_w, MAX_PATH);
+    file = CreateFileW(filename_w, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    mapping = CreateFileMappingW(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if (mapping) {
+        ptr = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, size);
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    return ptr;
+}
+
+void unmap_file(void *ptr, size_t size)
+{
+    (void)size;
+    UnmapViewOfFile(ptr);
+}
+
 #endif
@@ -12,6 +12,10 @@ extern "C" {
 /* Some really crappy APIs don't use UTF-8 in fopen. */
 FILE *fopen_utf8(const char *filename, const char *mode);
 
+/* Maps the start of a file copy-on-write, returns NULL if it can't be mapped */
+void *map_file_private(const char *filename, size_t size);
+void unmap_file(void *ptr, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
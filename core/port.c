@@ -1,3 +1,5 @@
+#include <stdlib.h>
+
 #include "port.h"
 #include "debug/debug.h"
 
@@ -8,9 +10,60 @@ eZ80portrange_t port_map[0x10];
 
 static const uint32_t port_mirrors[0x10] = {0x7F,0xFF,0xFF,0x1FF,0xFFF,0xFF,0x1F,0xFF,0x7F,0xFFF,0x7F,0xFFF,0xFF,0x7F,0x7F,0xFFF};
 
+/* Per byte storage of plain registers, NULL goes to the device handler */
+static struct {
+    uint8_t **read;
+    uint8_t **write;
+} port_tables[0x10];
+
+void port_free_tables(void) {
+    unsigned int i;
+    for (i = 0; i < 0x10; i++) {
+        free(port_tables[i].read);
+        free(port_tables[i].write);
+        port_tables[i].read = port_tables[i].write = NULL;
+    }
+}
+
+void port_build_tables(void) {
+    const eZ80portreg_t *reg;
+    unsigned int i, j;
+
+    port_free_tables();
+    for (i = 0; i < 0x10; i++) {
+        if (!port_map[i].regs) {
+            continue;
+        }
+        port_tables[i].read = calloc(port_mirrors[i] + 1, sizeof(uint8_t*));
+        port_tables[i].write = calloc(port_mirrors[i] + 1, sizeof(uint8_t*));
+        if (!port_tables[i].read || !port_tables[i].write) {
+            abort();
+        }
+        for (reg = port_map[i].regs; reg->size; reg++) {
+            for (j = 0; j < reg->size; j++) {
+                uint8_t *ptr = (uint8_t*)reg->data + j;
+                if (reg->flags & PORT_READ) {
+                    port_tables[i].read[reg->offset + j] = ptr;
+                }
+                if (reg->flags & PORT_WRITE) {
+                    port_tables[i].write[reg->offset + j] = ptr;
+                }
+            }
+        }
+    }
+}
+
 static uint8_t port_read(uint16_t address, bool peek) {
     uint8_t port_loc = port_range(address);
-    return port_map[port_loc].read_in(address & port_mirrors[port_loc], peek);
+    uint16_t offset = address & port_mirrors[port_loc];
+    uint8_t **table = port_tables[port_loc].read;
+    if (port_map[port_loc].read_hook) {
+        port_map[port_loc].read_hook();
+    }
+    if (table && table[offset]) {
+        return *table[offset];
+    }
+    return port_map[port_loc].read_in(offset, peek);
 }
 uint8_t port_peek_byte(uint16_t address) {
     return port_read(address, true);
@@ -23,10 +76,21 @@ uint8_t port_read_byte(uint16_t address) {
 #endif
     return port_read(address, false);
 }
+#ifdef DEBUG_SUPPORT
+uint8_t port_read_byte_lean(uint16_t address) {
+    return port_read(address, false);
+}
+#endif
 
 static void port_write(uint16_t address, uint8_t value, bool peek) {
     uint8_t port_loc = port_range(address);
-    port_map[port_loc].write_out(address & port_mirrors[port_loc], value, peek);
+    uint16_t offset = address & port_mirrors[port_loc];
+    uint8_t **table = port_tables[port_loc].write;
+    if (table && table[offset]) {
+        *table[offset] = value;
+        return;
+    }
+    port_map[port_loc].write_out(offset, value, peek);
 }
 void port_poke_byte(uint16_t address, uint8_t value) {
     port_write(address, value, true);
@@ -42,3 +106,8 @@ void port_write_byte(uint16_t address, uint8_t value) {
 #endif
     port_write(address, value, false);
 }
+#ifdef DEBUG_SUPPORT
+void port_write_byte_lean(uint16_t address, uint8_t value) {
+    port_write(address, value, false);
+}
+#endif
@@ -7,17 +7,41 @@ extern "C" {
 
 #include "defines.h"
 
+/* Register access flags */
+#define PORT_READ  1    /* reads are served from the storage */
+#define PORT_WRITE 2    /* writes are stored without side effects */
+
+/* Plain register, size bytes at offset in the range backed by data */
+typedef struct eZ80portreg {
+    uint16_t offset;
+    uint16_t size;
+    void *data;
+    uint8_t flags;
+} eZ80portreg_t;
+
+/* Accesses not covered by regs go to read_in / write_out */
 typedef struct eZ80portrange {
     uint8_t (*read_in)(uint16_t, bool);
     void (*write_out)(uint16_t, uint8_t, bool);
+    const eZ80portreg_t *regs;      /* optional, terminated by a zero size */
+    void (*read_hook)(void);        /* optional, called on every read */
 } eZ80portrange_t;
 
 extern eZ80portrange_t port_map[0x10];
 
+/* Builds the register lookup tables from port_map */
+void port_build_tables(void);
+void port_free_tables(void);
+
 uint8_t port_peek_byte(uint16_t addr);
 uint8_t port_read_byte(uint16_t addr);
 void port_poke_byte(uint16_t addr, uint8_t value);
 void port_write_byte(uint16_t addr, uint8_t value);
+#ifdef DEBUG_SUPPORT
+/* Without port monitors, for the lean cpu core */
+uint8_t port_read_byte_lean(uint16_t addr);
+void port_write_byte_lean(uint16_t addr, uint8_t value);
+#endif
 
 #ifdef __cplusplus
 }
@@ -23,7 +23,7 @@ sched_state_t sched;
 
 static uint32_t muldiv(uint32_t a, uint32_t b, uint32_t c) {
 #if defined(__i386__) || defined(__x86_64__)
-    asm ("mull %k1\n\tdivl %k2" : "+a" (a) : "g" (b), "g" (c) : "cc", "edx");
+    asm ("mull %k1\n\tdivl %k2" : "+a" (a) : "rm" (b), "rm" (c) : "cc", "edx");
     return a;
 #else
     uint64_t d = a;
@@ -32,38 +32,223 @@ static uint32_t muldiv(uint32_t a, uint32_t b, uint32_t c) {
 #endif
 }
 
+/* b / c as quot + frac / 2^64, frac rounded up. For any 32-bit a the error
+ * stays below 1 / c, so a * b / c is exact without dividing. */
+typedef struct {
+    uint32_t quot;
+    uint64_t frac;
+} sched_ratio_t;
+
+static struct {
+    sched_ratio_t toCPU[CLOCK_NUM_ITEMS];   /* clock ticks to cpu cycles */
+    sched_ratio_t fromCPU[CLOCK_NUM_ITEMS]; /* cpu cycles to clock ticks */
+    sched_ratio_t perTick[CLOCK_NUM_ITEMS]; /* 1 / rate, for splitting off seconds */
+} ratios;
+
+static sched_ratio_t ratio(uint32_t b, uint32_t c) {
+    sched_ratio_t r;
+    uint64_t rem = b % c, hi, lo;
+    r.quot = b / c;
+    hi = (rem << 32) / c;
+    rem = (rem << 32) % c;
+    lo = (rem << 32) / c;
+    rem = (rem << 32) % c;
+    r.frac = (hi << 32 | lo) + (rem != 0);
+    return r;
+}
+
+static uint32_t ratio_mul(uint32_t a, const sched_ratio_t *r) {
+    uint64_t hi = (uint64_t)a * (r->frac >> 32);
+    uint64_t lo = (uint64_t)a * (uint32_t)r->frac;
+    return a * r->quot + (uint32_t)((hi + (lo >> 32)) >> 32);
+}
+
+void sched_update_rates(void) {
+    int i;
+    for (i = 0; i < CLOCK_NUM_ITEMS; i++) {
+        ratios.toCPU[i] = ratio(sched.clockRates[CLOCK_CPU], sched.clockRates[i]);
+        ratios.fromCPU[i] = ratio(sched.clockRates[i], sched.clockRates[CLOCK_CPU]);
+        ratios.perTick[i] = ratio(1, sched.clockRates[i]);
+    }
+}
+
+/* Min-heap of item indices keyed on absolute cpu cycle deadlines, ties go to
+ * the lower index. Items disabled by writing second directly stay queued until
+ * they reach the top. */
+static struct {
+    uint64_t deadline[SCHED_MAX_ITEMS];
+    uint8_t heap[SCHED_MAX_ITEMS];
+    int8_t pos[SCHED_MAX_ITEMS]; /* -1 when not queued */
+    unsigned int size;
+    bool stale; /* items were set up without going through the queue */
+} queue;
+
+static bool queue_before(int a, int b) {
+    return queue.deadline[a] < queue.deadline[b] ||
+          (queue.deadline[a] == queue.deadline[b] && a < b);
+}
+
+static void queue_place(unsigned int i, int index) {
+    queue.heap[i] = index;
+    queue.pos[index] = i;
+}
+
+static void queue_sift(unsigned int i) {
+    int index = queue.heap[i];
+    while (i && queue_before(index, queue.heap[(i - 1) / 2])) {
+        queue_place(i, queue.heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        unsigned int child = 2 * i + 1;
+        if (child >= queue.size) {
+            break;
+        }
+        if (child + 1 < queue.size && queue_before(queue.heap[child + 1], queue.heap[child])) {
+            child++;
+        }
+        if (!queue_before(queue.heap[child], index)) {
+            break;
+        }
+        queue_place(i, queue.heap[child]);
+        i = child;
+    }
+    queue_place(i, index);
+}
+
+static void queue_remove(int index) {
+    int i = queue.pos[index];
+    if (queue.stale || i < 0) {
+        return;
+    }
+    queue.pos[index] = -1;
+    if ((unsigned int)i != --queue.size) {
+        queue_place(i, queue.heap[queue.size]);
+        queue_sift(i);
+    }
+}
+
+static void queue_update(int index) {
+    if (queue.stale) {
+        return;
+    }
+    queue.deadline[index] = sched.secondStart + (uint64_t)(sched.items[index].second - sched.second) * sched.clockRates[CLOCK_CPU] + sched.items[index].cputick;
+    if (queue.pos[index] < 0) {
+        queue_place(queue.size++, index);
+    }
+    queue_sift(queue.pos[index]);
+}
+
+/* Picks up an item whose proc was set on a zeroed item, which makes it due now */
+static void queue_sync(int index) {
+    if (!queue.stale && queue.pos[index] < 0 && sched.items[index].proc != NULL && sched.items[index].second >= 0) {
+        queue_update(index);
+    }
+}
+
+static void queue_rebuild(void) {
+    int i;
+    queue.size = 0;
+    queue.stale = false;
+    memset(queue.pos, -1, sizeof queue.pos);
+    for (i = 0; i < sched.numItems; i++) {
+        if (sched.items[i].proc != NULL && sched.items[i].second >= 0) {
+            queue_update(i);
+        }
+    }
+}
+
 void sched_reset(void) {
     const uint32_t def_rates[CLOCK_NUM_ITEMS] = { 48000000, 78000000, 27000000, 12000000, 24000000, 32768 };
+    int i;
     memcpy(sched.clockRates, def_rates, sizeof(def_rates));
-    memset(sched.items, 0, sizeof sched.items);
+    sched_update_rates();
+    memset(sched.items, 0, sizeof(struct sched_item) * SCHED_NUM_ITEMS);
+    /* registered items keep their proc, but start out disabled */
+    for (i = SCHED_NUM_ITEMS; i < sched.numItems; i++) {
+        sched.items[i].second = -1;
+    }
+    if (sched.numItems < SCHED_NUM_ITEMS) {
+        sched.numItems = SCHED_NUM_ITEMS;
+    }
     sched.nextIndex = 0;
+    sched.second = 0;
+    sched.secondStart = cpu.cycles;
+    queue.stale = true;
+}
+
+int sched_register(enum clock_id clock, void (*proc)(int index)) {
+    int i;
+    if (sched.numItems < SCHED_NUM_ITEMS) {
+        sched.numItems = SCHED_NUM_ITEMS;
+    }
+    for (i = SCHED_NUM_ITEMS; i < sched.numItems; i++) {
+        if (sched.items[i].proc == proc) {
+            return i;
+        }
+    }
+    if (sched.numItems == SCHED_MAX_ITEMS) {
+        abort();
+    }
+    sched.items[sched.numItems].clock = clock;
+    sched.items[sched.numItems].second = -1;
+    sched.items[sched.numItems].proc = proc;
+    queue.stale = true;
+    return sched.numItems++;
 }
 
 void event_repeat(int index, uint64_t ticks) {
     struct sched_item *item = &sched.items[index];
+    uint32_t rate = sched.clockRates[item->clock];
+
+    uint64_t seconds;
 
     ticks += item->tick;
-    item->second = ticks / sched.clockRates[item->clock];
-    item->tick = ticks % sched.clockRates[item->clock];
+    if (ticks >> 32) {
+        seconds = ticks / rate;
+    } else {
+        seconds = ratio_mul((uint32_t)ticks, &ratios.perTick[item->clock]);
+    }
+    item->second = sched.second + seconds;
+    item->tick = ticks - seconds * rate;
+
+    item->cputick = ratio_mul(item->tick, &ratios.toCPU[item->clock]);
+
+    queue_update(index);
+    sched_update_next_event();
+}
 
-    item->cputick = muldiv(item->tick, sched.clockRates[CLOCK_CPU], sched.clockRates[item->clock]);
+/* Cycle the cpu is never run past, see sched_set_stop */
+static uint64_t stopCPUtick = UINT64_MAX;
 
+void sched_set_stop(uint64_t cycle) {
+    stopCPUtick = cycle;
     sched_update_next_event();
 }
 
 void sched_update_next_event(void) {
-    int i;
-    sched.nextCPUtick = sched.clockRates[CLOCK_CPU];
+    if (queue.stale) {
+        queue_rebuild();
+    }
+    while (queue.size) {
+        struct sched_item *item = &sched.items[queue.heap[0]];
+        if (item->proc != NULL && item->second >= 0) {
+            break;
+        }
+        queue_remove(queue.heap[0]);
+    }
+
+    sched.nextCPUtick = sched.secondStart + sched.clockRates[CLOCK_CPU];
     sched.nextIndex = -1;
 
-    for(i = 0; i < SCHED_NUM_ITEMS; i++) {
-        struct sched_item *item = &sched.items[i];
-        if (item->proc != NULL && item->second == 0 && item->cputick < sched.nextCPUtick) {
-            sched.nextCPUtick = item->cputick;
-            sched.nextIndex = i;
+    if (queue.size) {
+        int index = queue.heap[0];
+        if (queue.deadline[index] < sched.nextCPUtick) {
+            sched.nextCPUtick = queue.deadline[index];
+            sched.nextIndex = index;
         }
     }
-    cpu.next = sched.nextCPUtick;
+    cpu.next = sched.nextCPUtick < stopCPUtick ? sched.nextCPUtick : stopCPUtick;
 #ifdef DEBUG_SUPPORT
     if (!cpu.halted && (cpuEvents & EVENT_DEBUG_STEP)) {
         cpu.next = debugger.cpu_cycles + 1;
@@ -75,16 +260,11 @@ void sched_process_pending_events(void) {
     sched_update_next_event();
     while (cpu.cycles >= sched.nextCPUtick) {
         if (sched.nextIndex < 0) {
-            int i;
-            for (i = 0; i < SCHED_NUM_ITEMS; i++) {
-                if (sched.items[i].second >= 0) {
-                    sched.items[i].second--;
-                }
-            }
-            cpu.cycles -= sched.clockRates[CLOCK_CPU];
-            cpu.cycles_offset += sched.clockRates[CLOCK_CPU];
+            sched.secondStart += sched.clockRates[CLOCK_CPU];
+            sched.second++;
         } else {
             sched.items[sched.nextIndex].second = -1;
+            queue_remove(sched.nextIndex);
             sched.items[sched.nextIndex].proc(sched.nextIndex);
         }
         sched_update_next_event();
@@ -92,52 +272,56 @@ void sched_process_pending_events(void) {
 }
 
 void event_clear(int index) {
+    queue_sync(index);
     sched_process_pending_events();
 
     sched.items[index].second = -1;
+    queue_remove(index);
 
     sched_update_next_event();
 }
 
 void event_set(int index, uint64_t ticks) {
     struct sched_item *item;
+    queue_sync(index);
     sched_process_pending_events();
 
     item = &sched.items[index];
-    item->tick = muldiv(cpu.cycles, sched.clockRates[item->clock], sched.clockRates[CLOCK_CPU]);
+    item->tick = ratio_mul(cpu.cycles - sched.secondStart, &ratios.fromCPU[item->clock]);
     event_repeat(index, ticks);
 }
 
 uint64_t event_ticks_remaining(int index) {
     struct sched_item *item;
+    queue_sync(index);
     sched_process_pending_events();
 
     item = &sched.items[index];
-    return (uint64_t)item->second * sched.clockRates[item->clock]
-        + item->tick - muldiv(cpu.cycles, sched.clockRates[item->clock], sched.clockRates[CLOCK_CPU]);
+    return (uint64_t)(item->second - sched.second) * sched.clockRates[item->clock]
+        + item->tick - ratio_mul(cpu.cycles - sched.secondStart, &ratios.fromCPU[item->clock]);
 }
 
 void sched_set_clocks(int count, uint32_t *new_rates) {
     int i;
-    uint64_t remaining[SCHED_NUM_ITEMS];
+    uint64_t remaining[SCHED_MAX_ITEMS];
     sched_process_pending_events();
 
-    for (i = 0; i < SCHED_NUM_ITEMS; i++) {
+    for (i = 0; i < sched.numItems; i++) {
         struct sched_item *item = &sched.items[i];
         if (item->second >= 0) {
             remaining[i] = event_ticks_remaining(i);
         }
     }
 
-    cpu.cycles_offset += cpu.cycles;
-    cpu.cycles = muldiv(cpu.cycles, new_rates[CLOCK_CPU], sched.clockRates[CLOCK_CPU]);
-    cpu.cycles_offset -= cpu.cycles;
+    /* rescale how far into the current second we are, time itself doesn't jump */
+    sched.secondStart = cpu.cycles - muldiv(cpu.cycles - sched.secondStart, new_rates[CLOCK_CPU], sched.clockRates[CLOCK_CPU]);
     memcpy(sched.clockRates, new_rates, sizeof(uint32_t) * count);
+    sched_update_rates();
 
-    for (i = 0; i < SCHED_NUM_ITEMS; i++) {
+    for (i = 0; i < sched.numItems; i++) {
         struct sched_item *item = &sched.items[i];
         if (item->second >= 0) {
-            item->tick = muldiv(cpu.cycles, sched.clockRates[item->clock], sched.clockRates[CLOCK_CPU]);
+            item->tick = ratio_mul(cpu.cycles - sched.secondStart, &ratios.fromCPU[item->clock]);
             event_repeat(i, remaining[i]);
         }
     }
@@ -146,10 +330,10 @@ void sched_set_clocks(int count, uint32_t *new_rates) {
 }
 
 bool sched_save(emu_image *s) {
-    unsigned int i;
+    int i;
     s->sched = sched;
 
-    for(i = 0; i < SCHED_NUM_ITEMS; i++) {
+    for(i = 0; i < sched.numItems; i++) {
         s->sched.items[i].proc = NULL;
     }
 
@@ -157,8 +341,11 @@ bool sched_save(emu_image *s) {
 }
 
 bool sched_restore(const emu_image *s) {
-    unsigned int i;
-    for(i = 0; i < SCHED_NUM_ITEMS; i++) {
+    int i;
+    if (s->sched.numItems != sched.numItems) {
+        return false;
+    }
+    for(i = 0; i < sched.numItems; i++) {
         struct sched_item j = s->sched.items[i];
         j.proc = sched.items[i].proc;
         if (!j.proc) {
@@ -167,8 +354,12 @@ bool sched_restore(const emu_image *s) {
         sched.items[i] = j;
     }
     memcpy(sched.clockRates, s->sched.clockRates, sizeof(sched.clockRates));
+    sched_update_rates();
     sched.nextCPUtick = s->sched.nextCPUtick;
     sched.nextIndex = s->sched.nextIndex;
+    sched.second = s->sched.second;
+    sched.secondStart = s->sched.secondStart;
+    queue.stale = true;
     sched_update_next_event();
     return true;
 }
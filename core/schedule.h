@@ -23,19 +23,25 @@ enum sched_item_index {
     SCHED_NUM_ITEMS
 };
 
+/* Built-in items plus the ones added with sched_register */
+#define SCHED_MAX_ITEMS 24
+
 struct sched_item {
     enum clock_id clock;
-    int second; /* -1 = disabled */
+    int second; /* second it is due in, -1 = disabled */
     uint32_t tick;
     uint32_t cputick;
     void (*proc)(int index);
 };
 
 PACK(typedef struct sched_state {
-    struct sched_item items[SCHED_NUM_ITEMS];
+    struct sched_item items[SCHED_MAX_ITEMS];
     uint32_t clockRates[CLOCK_NUM_ITEMS];
-    uint32_t nextCPUtick;
+    uint64_t nextCPUtick;
     int nextIndex; /* -1 if no more events this second */
+    int numItems;
+    int second;
+    uint64_t secondStart; /* cpu cycle the current second started at */
 }) sched_state_t;
 
 /* Global SCHED state */
@@ -43,12 +49,15 @@ extern sched_state_t sched;
 
 /* Available Functions */
 void sched_reset(void);
+int sched_register(enum clock_id clock, void (*proc)(int index));
 void event_repeat(int index, uint64_t ticks);
 void sched_update_next_event(void);
 void sched_process_pending_events(void);
 void event_clear(int index);
 void event_set(int index, uint64_t ticks);
 void sched_set_clocks(int count, uint32_t *new_rates);
+void sched_update_rates(void); /* call after writing clockRates directly */
+void sched_set_stop(uint64_t cycle); /* end cpu_execute at this cycle, UINT64_MAX for none */
 uint64_t event_ticks_remaining(int index);
 
 /* Save/Restore */
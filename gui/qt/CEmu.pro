@@ -108,6 +108,7 @@ SOURCES +=  utils.cpp \
     ../../tests/autotester/autotester.cpp \
     ../../core/asic.c \
     ../../core/cpu.c \
+    ../../core/cpu_lean.c \
     ../../core/keypad.c \
     ../../core/lcd.c \
     ../../core/registers.c \
@@ -127,6 +128,7 @@ SOURCES +=  utils.cpp \
     ../../core/link.c \
     ../../core/vat.c \
     ../../core/emu.c \
+    ../../core/emuimage.c \
     ../../core/extras.c \
     ../../core/debug/disasm.cpp \
     ../../core/debug/debug.c \
@@ -194,6 +196,7 @@ HEADERS  +=  utils.h \
     ../../core/port.h \
     ../../core/interrupt.h \
     ../../core/emu.h \
+    ../../core/emuimage.h \
     ../../core/flash.h \
     ../../core/misc.h \
     ../../core/schedule.h \
@@ -5,11 +5,13 @@
 
 struct CEmuOpts {
     int speed;
+    int throttleSlice;
     bool restoreOnOpen;
     bool useUnthrottled;
     bool suppressTestDialog;
     bool deforceReset;
     bool forceReloadRom;
+    bool mapRom;
     QString romFile;
     QString autotesterFile;
     QString settingsFile;
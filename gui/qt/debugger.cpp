@@ -21,6 +21,7 @@
 #include "dockwidget.h"
 #include "utils.h"
 
+#include "../../core/emu.h"
 #include "../../core/schedule.h"
 #include "../../core/link.h"
 
@@ -252,6 +253,7 @@ void MainWindow::debuggerExecuteCommand(uint32_t debugAddress, uint8_t command)
 
     // continue emulation
     inDebugger = false;
+    gui_emu_wake();
 }
 
 void MainWindow::debuggerProcessCommand(int reason, uint32_t input) {
@@ -1,5 +1,10 @@
 #include "emuthread.h"
 
+#include <QtCore/QEventLoop>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <cstdarg>
@@ -14,10 +19,27 @@
 EmuThread *emu_thread = nullptr;
 QTimer speedUpdateTimer;
 
+static QMutex emuWaitMutex;
+static QWaitCondition emuWaitCondition;
+
 void gui_emu_sleep(unsigned long microseconds) {
     QThread::usleep(microseconds);
 }
 
+// The check happens under the mutex, so a wake between it and the wait isn't lost.
+// The timeout only bounds the cost of a state change that forgot to wake.
+void gui_emu_wait(bool (*ready)(void)) {
+    QMutexLocker locker(&emuWaitMutex);
+    if (!ready()) {
+        emuWaitCondition.wait(&emuWaitMutex, 100);
+    }
+}
+
+void gui_emu_wake(void) {
+    QMutexLocker locker(&emuWaitMutex);
+    emuWaitCondition.wakeAll();
+}
+
 void gui_do_stuff(void) {
     emu_thread->doStuff();
 }
@@ -64,13 +86,14 @@ void gui_debugger_raise_or_disable(bool entered) {
     }
 }
 
-void throttle_timer_wait(void) {
-    emu_thread->throttleTimerWait();
+void throttle_timer_wait(uint32_t ticks) {
+    emu_thread->throttleTimerWait(ticks);
 }
 
 void gui_entered_send_state(bool entered) {
     if (entered) {
         emu_thread->waitForLink = false;
+        emit emu_thread->linkEntered();
     }
 }
 
@@ -78,7 +101,8 @@ EmuThread::EmuThread(QObject *p) : QThread(p) {
     assert(emu_thread == nullptr);
     emu_thread = this;
     speed = actualSpeed = 100;
-    lastTime = std::chrono::steady_clock::now();
+    windowStart = std::chrono::steady_clock::now();
+    windowLate = windowMaxLate = std::chrono::steady_clock::duration::zero();
     connect(&speedUpdateTimer, SIGNAL(timeout()), this, SLOT(sendActualSpeed()));
 }
 
@@ -90,6 +114,17 @@ void EmuThread::setEmuSpeed(int value) {
     speed = value;
 }
 
+// Slice length in milliseconds, up to one frame
+void EmuThread::setThrottleSlice(int ms) {
+    if (ms < 1) {
+        ms = 1;
+    }
+    if (ms > 16) {
+        ms = 16;
+    }
+    throttleSlice = 27000000 / 1000 * ms;
+}
+
 void EmuThread::changeThrottleMode(bool mode) {
     throttleOn = mode;
 }
@@ -98,48 +133,78 @@ void EmuThread::setDebugMode(bool state) {
     enterDebugger = state;
     if (inDebugger && !state) {
         inDebugger = false;
+        gui_emu_wake();
     }
     debug_clear_temp_break();
 }
 
 void EmuThread::setSendState(bool state) {
+    if (state) {
+        waitForLink = true;
+    }
     enterSendState = state;
     isSending = state;
+    gui_emu_wake();
 }
 
 void EmuThread::setReceiveState(bool state) {
+    if (state) {
+        waitForLink = true;
+    }
     enterReceiveState = state;
     isReceiving = state;
+    gui_emu_wake();
+}
+
+// Runs the gui event loop until the emu thread is parked in the link state
+bool EmuThread::waitLinkEntered(int timeout) {
+    QEventLoop loop;
+    QTimer timer;
+    timer.setSingleShot(true);
+    connect(&timer, &QTimer::timeout, &loop, &QEventLoop::quit);
+    connect(this, &EmuThread::linkEntered, &loop, &QEventLoop::quit);
+
+    // checked after connecting so the signal can't slip in between
+    if (waitForLink) {
+        timer.start(timeout);
+        loop.exec();
+    }
+    return !waitForLink;
 }
 
 void EmuThread::setRunUntilMode() {
     debug_set_run_until();
     enterDebugger = false;
     inDebugger = false;
+    gui_emu_wake();
 }
 
 void EmuThread::setDebugStepInMode() {
     debug_set_step_in();
     enterDebugger = false;
     inDebugger = false;
+    gui_emu_wake();
 }
 
 void EmuThread::setDebugStepOverMode() {
     debug_set_step_over();
     enterDebugger = false;
     inDebugger = false;
+    gui_emu_wake();
 }
 
 void EmuThread::setDebugStepNextMode() {
     debug_set_step_next();
     enterDebugger = false;
     inDebugger = false;
+    gui_emu_wake();
 }
 
 void EmuThread::setDebugStepOutMode() {
     debug_set_step_out();
     enterDebugger = false;
     inDebugger = false;
+    gui_emu_wake();
 }
 
 void gui_set_busy(bool busy) {
@@ -184,12 +249,14 @@ void EmuThread::doStuff() {
         open_debugger(DBG_USER, 0);
     }
 
-    lastTime += std::chrono::steady_clock::now() - cur_time;
+    // time spent here is not the emulator running late
+    paceAnchor += std::chrono::steady_clock::now() - cur_time;
 }
 
 void EmuThread::sendActualSpeed() {
     if (!calc_is_off()) {
         emit actualSpeedChanged(actualSpeed);
+        emit throttleLatenessChanged(latenessAvg, latenessMax);
     }
 }
 
@@ -199,26 +266,78 @@ void EmuThread::setActualSpeed(int value) {
     }
 }
 
-void EmuThread::throttleTimerWait() {
+// Oversleeping is corrected by spinning for the last part of each wait, which
+// has to stay well below the shortest slice or the thread never sleeps
+static const std::chrono::microseconds paceSpinMargin(200);
+// Falling further behind than this drops the lost time instead of racing to catch up
+static const std::chrono::milliseconds paceCatchUpCap(50);
+// Window over which the actual speed and the lateness are measured
+static const std::chrono::milliseconds paceWindow(500);
+
+void EmuThread::throttleTimerWait(uint32_t slice) {
     if (!speed) {
         setActualSpeed(0);
         while(!speed) {
             QThread::usleep(10000);
         }
+        paceSpeed = 0;
         return;
     }
-    std::chrono::duration<int, std::ratio<100, 60>> unit(1);
-    std::chrono::steady_clock::duration interval(std::chrono::duration_cast<std::chrono::steady_clock::duration>
-                                                (std::chrono::duration<int, std::ratio<1, 60 * 1000000>>(1000000 * 100 / speed)));
-    std::chrono::steady_clock::time_point cur_time = std::chrono::steady_clock::now(), next_time = lastTime + interval;
-    if (throttleOn && cur_time < next_time) {
-        setActualSpeed(speed);
-        lastTime = next_time;
-        std::this_thread::sleep_until(next_time);
-    } else {
-        setActualSpeed(unit / (cur_time - lastTime));
-        lastTime = cur_time;
+
+    std::chrono::steady_clock::time_point cur_time = std::chrono::steady_clock::now();
+    int curSpeed = speed;
+
+    if (curSpeed != paceSpeed) {
+        paceAnchor = cur_time;
+        paceTicks = 0;
+        paceSpeed = curSpeed;
+    }
+    paceTicks += slice;
+    windowTicks += slice;
+    windowSlices++;
+
+    // 27MHz ticks scaled by the speed percentage, in nanoseconds
+    std::chrono::steady_clock::time_point next_time = paceAnchor +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::nanoseconds(paceTicks * 100000 / (27 * curSpeed)));
+
+    if (!throttleOn || cur_time > next_time + paceCatchUpCap) {
+        if (throttleOn) {
+            std::chrono::steady_clock::duration late = cur_time - next_time;
+            windowLate += late;
+            windowMaxLate = std::max(windowMaxLate, late);
+        }
+        paceAnchor = cur_time;
+        paceTicks = 0;
         std::this_thread::yield();
+    } else {
+        if (next_time - cur_time > paceSpinMargin) {
+            std::this_thread::sleep_until(next_time - paceSpinMargin);
+        }
+        while ((cur_time = std::chrono::steady_clock::now()) < next_time) {
+            std::this_thread::yield();
+        }
+        std::chrono::steady_clock::duration late = cur_time - next_time;
+        windowLate += late;
+        windowMaxLate = std::max(windowMaxLate, late);
+
+        // rebase once in a while so the tick count can't overflow the conversion
+        if (paceTicks >= 27000000ULL * 60) {
+            paceAnchor = next_time;
+            paceTicks = 0;
+        }
+    }
+
+    std::chrono::steady_clock::duration elapsed = cur_time - windowStart;
+    if (elapsed >= paceWindow) {
+        std::chrono::nanoseconds real = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+        latenessAvg = static_cast<int>(std::chrono::duration_cast<std::chrono::microseconds>(windowLate).count() / windowSlices);
+        latenessMax = static_cast<int>(std::chrono::duration_cast<std::chrono::microseconds>(windowMaxLate).count());
+        setActualSpeed(static_cast<int>(windowTicks * 100000 / 27 / static_cast<uint64_t>(real.count())));
+        windowStart = cur_time;
+        windowLate = windowMaxLate = std::chrono::steady_clock::duration::zero();
+        windowTicks = 0;
+        windowSlices = 0;
     }
 }
 
@@ -255,6 +374,7 @@ bool EmuThread::stop() {
     /* Cause the CPU core to leave the loop and check for events */
     exiting = true; // exit outer loop
     cpu.next = 0;   // exit inner loop
+    gui_emu_wake();
 
     if (!this->wait(200)) {
         terminate();
@@ -17,7 +17,8 @@ public:
     explicit EmuThread(QObject *p = Q_NULLPTR);
 
     void doStuff();
-    void throttleTimerWait();
+    void throttleTimerWait(uint32_t slice);
+    bool waitLinkEntered(int timeout);
     volatile bool waitForLink = false;
     QString rom, image;
 
@@ -32,9 +33,11 @@ signals:
     void consoleStr(QString);
     void consoleErrStr(QString);
     void exited(int);
+    void linkEntered();
 
     // Status
     void actualSpeedChanged(int);
+    void throttleLatenessChanged(int, int);
     void isBusy(bool busy);
 
     // Save/Restore state
@@ -64,6 +67,7 @@ public slots:
 
     // Speed
     void setEmuSpeed(int);
+    void setThrottleSlice(int);
     void changeThrottleMode(bool);
 
     // Save/Restore
@@ -78,11 +82,23 @@ private:
     void setActualSpeed(int);
 
     volatile int speed, actualSpeed;
+    volatile int latenessAvg = 0, latenessMax = 0;
     bool enterDebugger = false;
     bool enterSendState = false;
     bool enterReceiveState = false;
     bool throttleOn = true;
-    std::chrono::steady_clock::time_point lastTime;
+
+    // Pacing: slices are due at anchor + emulated time since the anchor, so
+    // rounding and oversleeping never accumulate into drift
+    std::chrono::steady_clock::time_point paceAnchor;
+    uint64_t paceTicks = 0;
+    int paceSpeed = 0;
+
+    // Lateness and actual speed over the current measuring window
+    std::chrono::steady_clock::time_point windowStart;
+    std::chrono::steady_clock::duration windowLate, windowMaxLate;
+    uint64_t windowTicks = 0;
+    unsigned int windowSlices = 0;
     QString romExportPath;
     volatile bool saveImage = false;
     volatile bool saveRom = false;
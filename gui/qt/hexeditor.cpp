@@ -85,9 +85,8 @@ void MainWindow::memUpdate(uint32_t addressBegin) {
 
     memSize = end-start;
 
-    for (int32_t i=start; i<end; i++) {
-        mem_data.append(mem_peek_byte(i));
-    }
+    mem_data.resize(memSize);
+    virt_mem_cpy(reinterpret_cast<uint8_t*>(mem_data.data()), start, memSize);
 
     ui->memEdit->setData(mem_data);
     ui->memEdit->setAddressOffset(start);
@@ -242,12 +241,14 @@ void MainWindow::syncHexView(int posa, QHexEdit *hex_view) {
 void MainWindow::flashSyncPressed() {
     qint64 posa = ui->flashEdit->cursorPosition();
     memcpy(mem.flash.block, ui->flashEdit->data().data(), 0x400000);
+    mem_dirty_all();
     syncHexView(posa, ui->flashEdit);
 }
 
 void MainWindow::ramSyncPressed() {
     qint64 posa = ui->ramEdit->cursorPosition();
     memcpy(mem.ram.block, ui->ramEdit->data().data(), 0x65800);
+    mem_dirty_range(0xD00000, ram_size);
     syncHexView(posa, ui->ramEdit);
 }
 
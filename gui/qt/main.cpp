@@ -100,11 +100,21 @@ int main(int argc, char *argv[]) {
                 QCoreApplication::translate("main", "Forces a rom reload"));
     parser.addOption(forceRomReload);
 
+    QCommandLineOption mapRom(QStringList() << "map-rom",
+                QCoreApplication::translate("main", "Share unmodified rom pages with other instances"));
+    parser.addOption(mapRom);
+
     QCommandLineOption emuSpeed(QStringList() << "speed",
                 QCoreApplication::translate("main", "Set emulation speed percentage (value 0-500; step 10)"),
                 QCoreApplication::translate("main", "speed"));
     parser.addOption(emuSpeed);
 
+    // Throttle pacing granularity
+    QCommandLineOption throttleSlice(QStringList() << "throttle-slice",
+                QCoreApplication::translate("main", "Set throttle slice length in milliseconds (value 1-16)"),
+                QCoreApplication::translate("main", "ms"));
+    parser.addOption(throttleSlice);
+
     // IPC hooks (can only use on an already running process)
 
     parser.process(app);
@@ -116,6 +126,7 @@ int main(int argc, char *argv[]) {
     opts.suppressTestDialog = parser.isSet(suppressTestDialog);
     opts.deforceReset       = parser.isSet(deforceReset);
     opts.forceReloadRom     = parser.isSet(forceRomReload);
+    opts.mapRom             = parser.isSet(mapRom);
     opts.romFile            = parser.value(loadRomFile);
     opts.settingsFile       = parser.value(settingsFile);
     opts.imageFile          = parser.value(imageFile);
@@ -130,6 +141,11 @@ int main(int argc, char *argv[]) {
     } else {
         opts.speed = -1;
     }
+    if (parser.isSet(throttleSlice)) {
+        opts.throttleSlice  = parser.value(throttleSlice).toInt();
+    } else {
+        opts.throttleSlice = -1;
+    }
     if (parser.isSet(loadTestFile)) {
         opts.autotesterFile = QDir::currentPath() + QDir::separator() + parser.value(loadTestFile);
     }
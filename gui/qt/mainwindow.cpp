@@ -29,6 +29,7 @@
 #include "utils.h"
 #include "capture/gif.h"
 
+#include "../../core/emu.h"
 #include "../../core/schedule.h"
 #include "../../core/link.h"
 
@@ -187,6 +188,7 @@ MainWindow::MainWindow(CEmuOpts cliOpts, QWidget *p) : QMainWindow(p), ui(new Ui
     connect(this, &MainWindow::setEmuSpeed, &emu, &EmuThread::setEmuSpeed);
     connect(this, &MainWindow::changedThrottleMode, &emu, &EmuThread::changeThrottleMode);
     connect(&emu, &EmuThread::actualSpeedChanged, this, &MainWindow::showActualSpeed, Qt::QueuedConnection);
+    connect(&emu, &EmuThread::throttleLatenessChanged, this, &MainWindow::showThrottleLateness, Qt::QueuedConnection);
     connect(ui->flashBytes, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), ui->flashEdit, &QHexEdit::setBytesPerLine);
     connect(ui->ramBytes, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), ui->ramEdit, &QHexEdit::setBytesPerLine);
     connect(ui->memBytes, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), ui->memEdit, &QHexEdit::setBytesPerLine);
@@ -405,6 +407,9 @@ MainWindow::MainWindow(CEmuOpts cliOpts, QWidget *p) : QMainWindow(p), ui(new Ui
     if (opts.speed != -1) {
         setEmulatedSpeed(opts.speed/10);
     }
+    if (opts.throttleSlice != -1) {
+        emu.setThrottleSlice(opts.throttleSlice);
+    }
     ui->afregView->installEventFilter(this);
     ui->hlregView->installEventFilter(this);
     ui->bcregView->installEventFilter(this);
@@ -502,6 +507,8 @@ void MainWindow::optCheckSend(CEmuOpts &o) {
 }
 
 void MainWindow::optLoadFiles(CEmuOpts &o) {
+    mapRomFile = o.mapRom;
+
     if (o.romFile.isEmpty()) {
         emu.rom = settings->value(QStringLiteral("romImage")).toString();
     } else {
@@ -741,6 +748,10 @@ void MainWindow::showActualSpeed(int speed) {
     speedLabel.setText(QStringLiteral(" ") + tr("Emulated Speed: ") + QString::number(speed, 10) + QStringLiteral("%"));
 }
 
+void MainWindow::showThrottleLateness(int avg, int max) {
+    speedLabel.setToolTip(tr("Throttle lateness: ") + QString::number(avg) + tr(" us average, ") + QString::number(max) + tr(" us max"));
+}
+
 void MainWindow::showStatusMsg(QString str) {
     msgLabel.setText(str);
 }
@@ -1001,7 +1012,7 @@ void MainWindow::refreshVariableList() {
         ui->buttonRun->setEnabled(false);
         setReceiveState(true);
         ui->emuVarView->blockSignals(true);
-        guiDelay(200);
+        emu.waitLinkEntered(2500);
 
         vat_search_init(&var);
         vars.clear();
@@ -1278,8 +1289,9 @@ void MainWindow::updateCRCParamsFromPreset(int comboBoxIndex) {
 
 void MainWindow::refreshCRC() {
     uint32_t tmp_start = 0;
-    int32_t crc_size = 0;
-    uint8_t* start;
+    uint32_t crc_size = 0;
+    uint32_t crc = 0;
+    mem_span_t span;
     char *endptr1, *endptr2; // catch strtoul issues
     QLineEdit *startCRC = ui->startCRC;
     QLineEdit *sizeCRC = ui->sizeCRC;
@@ -1293,18 +1305,26 @@ void MainWindow::refreshCRC() {
 
     // Get GUI values
     tmp_start = (uint32_t)strtoul(startCRC->text().toStdString().c_str(), &endptr1, 0);
-    crc_size = (size_t)strtoul(sizeCRC->text().toStdString().c_str(), &endptr2, 0);
+    crc_size = (uint32_t)strtoul(sizeCRC->text().toStdString().c_str(), &endptr2, 0);
     if (*endptr1 || *endptr2) {
         goto errCRCret;
     }
 
-    // Get real start pointer
-    start = virt_mem_dup(tmp_start, crc_size);
+    // Compute straight from the memory blocks
+    while (mem_span_next(&span, &tmp_start, &crc_size)) {
+        if (span.ptr) {
+            crc = crc32_append(crc, span.ptr, span.size);
+        } else {
+            for (uint32_t i = 0; i < span.size; i++) {
+                uint8_t byte = mem_peek_byte(span.addr + i);
+                crc = crc32_append(crc, &byte, 1);
+            }
+        }
+    }
 
-    // Compute and display CRC
+    // Display CRC
     char buf[10];
-    sprintf(buf, "%X", crc32(start, crc_size));
-    free(start);
+    sprintf(buf, "%X", crc);
     ui->valueCRC->setText(buf);
     return;
 
@@ -1662,6 +1682,7 @@ bool MainWindow::ipcSetup() {
            << opts.suppressTestDialog
            << opts.deforceReset
            << opts.forceReloadRom
+           << opts.mapRom
            << opts.romFile
            << opts.autotesterFile
            << opts.imageFile
@@ -1669,7 +1690,8 @@ bool MainWindow::ipcSetup() {
            << opts.sendArchFiles
            << opts.sendRAMFiles
            << opts.restoreOnOpen
-           << opts.speed;
+           << opts.speed
+           << opts.throttleSlice;
 
     // blocking call
     com->send(byteArray);
@@ -1684,6 +1706,7 @@ void MainWindow::ipcHandleCommandlineReceive(QDataStream &stream) {
            >> o.suppressTestDialog
            >> o.deforceReset
            >> o.forceReloadRom
+           >> o.mapRom
            >> o.romFile
            >> o.autotesterFile
            >> o.imageFile
@@ -1691,7 +1714,8 @@ void MainWindow::ipcHandleCommandlineReceive(QDataStream &stream) {
            >> o.sendArchFiles
            >> o.sendRAMFiles
            >> o.restoreOnOpen
-           >> o.speed;
+           >> o.speed
+           >> o.throttleSlice;
 
     optLoadFiles(o);
     optAttemptLoad(o);
@@ -1699,6 +1723,9 @@ void MainWindow::ipcHandleCommandlineReceive(QDataStream &stream) {
     if (o.speed != -1) {
         setEmulatedSpeed(o.speed/10);
     }
+    if (o.throttleSlice != -1) {
+        emu.setThrottleSlice(o.throttleSlice);
+    }
 }
 
 void MainWindow::ipcReceived() {
@@ -239,6 +239,7 @@ private:
     void setEmulatedSpeed(int);
     void setThrottleMode(int);
     void showActualSpeed(int);
+    void showThrottleLateness(int, int);
 
     // Console
     void showStatusMsg(QString);
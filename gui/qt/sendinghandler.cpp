@@ -81,14 +81,7 @@ void SendingHandler::sendFiles(QStringList fileNames, unsigned location) {
     }
 
     /* Wait for an open link */
-    unsigned int tries_cnt = 0;
-    emu_thread->waitForLink = true;
-    do {
-        guiDelay(50);
-        tries_cnt++;
-    } while (emu_thread->waitForLink && tries_cnt < 50);
-
-    if (emu_thread->waitForLink) {
+    if (!emu_thread->waitLinkEntered(2500)) {
         emu_thread->setSendState(false);
         QMessageBox::warning(nullptr, QObject::tr("Failed Transfer"), QObject::tr("Couldn't start the transfer. Make sure the calc is ready (at the home screen, for instance)."));
         return;
@@ -135,9 +135,22 @@ static const std::unordered_map<std::string, seq_cmd_func_t> valid_seq_commands
             if (tmp != config.hashes.end())
             {
                 const hash_params_t& param = tmp->second;
-                uint8_t *temp_buffer = cemucore::virt_mem_dup(param.start, param.size);
-                const uint32_t real_hash = crc32(temp_buffer, param.size);
-                ::free(temp_buffer);
+                cemucore::mem_span_t span;
+                uint32_t addr = param.start, size = param.size;
+                uint32_t real_hash = 0;
+                while (cemucore::mem_span_next(&span, &addr, &size))
+                {
+                    if (span.ptr)
+                    {
+                        real_hash = crc32_append(real_hash, span.ptr, span.size);
+                    } else {
+                        for (uint32_t i = 0; i < span.size; i++)
+                        {
+                            const uint8_t byte = cemucore::mem_peek_byte(span.addr + i);
+                            real_hash = crc32_append(real_hash, &byte, 1);
+                        }
+                    }
+                }
                 if (std::find(param.expected_CRCs.begin(), param.expected_CRCs.end(), real_hash) != param.expected_CRCs.end())
                 {
                     if (debugLogs) {
@@ -22,12 +22,14 @@ extern "C"
     auto lastTime = std::chrono::steady_clock::now();
 
     void gui_emu_sleep(void) { std::this_thread::sleep_for(std::chrono::microseconds(50)); }
+    void gui_emu_wait(bool (*)(void)) { std::this_thread::sleep_for(std::chrono::microseconds(50)); }
+    void gui_emu_wake(void) { }
     void gui_do_stuff(void) { }
     void gui_set_busy(bool) { }
     void gui_console_printf(const char*, ...) { }
     void gui_entered_send_state(bool) { }
 
-    void throttle_timer_wait()
+    void throttle_timer_wait(uint32_t)
     {
         auto interval  = std::chrono::duration_cast<std::chrono::steady_clock::duration>
                 (std::chrono::duration<int, std::ratio<1, 60 * 1000000>>(800000)); // a bit faster than normal
@@ -51,9 +53,17 @@ int main(int argc, char* argv[])
     // Used if the coreThread has been started (need to exit properly ; uses gotos)
     int retVal = 0;
 
+    if (argc == 3 && std::string(argv[1]) == "--map-rom")
+    {
+        // share unmodified rom pages with other running instances
+        cemucore::mapRomFile = true;
+        argv++;
+        argc--;
+    }
+
     if (argc != 2)
     {
-        std::cerr << "[Error] Needs one argument: path to the test config JSON file" << std::endl;
+        std::cerr << "[Error] Needs one argument: path to the test config JSON file (optionally preceded by --map-rom)" << std::endl;
         return -1;
     }
 
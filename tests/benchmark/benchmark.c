@@ -0,0 +1,119 @@
+/*
+ * Core benchmark
+ * Boots a rom, sends an asm program, launches it and runs a fixed number of
+ * emulated frames without throttling, timing each phase in cpu time.
+ * The same rom, program and frame count always execute the same instructions,
+ * so the times of differently built cores can be compared directly.
+ * Part of the CEmu project
+ * License: GPLv3
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../core/emu.h"
+#include "../../core/mem.h"
+#include "../../core/link.h"
+#include "../../core/extras.h"
+
+/* OS keycodes, as used by the autotester */
+#define CE_KEY_Enter    0x05
+#define CE_KEY_Clear    0x09
+#define CE_KEY_prgm     0xDA
+#define CE_KEY_Asm      0x9CFC
+
+#define BOOT_FRAMES     240
+#define KEY_FRAMES      10
+
+/* As expected by the core */
+void gui_do_stuff(void) { }
+void throttle_timer_wait(uint32_t ticks) { (void)ticks; }
+void gui_set_busy(bool busy) { (void)busy; }
+void gui_entered_send_state(bool entered) { (void)entered; }
+void gui_console_printf(const char *format, ...) { (void)format; }
+void gui_console_err_printf(const char *format, ...) { (void)format; }
+void gui_emu_sleep(unsigned long us) { (void)us; }
+void gui_emu_wait(bool (*ready)(void)) { (void)ready; exiting = true; }
+void gui_emu_wake(void) { }
+void gui_debugger_send_command(int reason, uint32_t data) { (void)reason; (void)data; }
+void gui_debugger_raise_or_disable(bool entered) { (void)entered; }
+void gui_render_gif_frame(void) { }
+
+static double cpu_seconds(void) {
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static uint64_t press(uint16_t key) {
+    sendKey(key);
+    return emu_run_frames(KEY_FRAMES);
+}
+
+/* The variable name is stored at offset 0x3C of an .8xp file */
+static bool program_name(const char *file, char name[9]) {
+    FILE *f = fopen(file, "rb");
+    bool ok = f && !fseek(f, 0x3C, SEEK_SET) && fread(name, 1, 8, f) == 8;
+    if (f) {
+        fclose(f);
+    }
+    name[8] = '\0';
+    return ok && name[0];
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t frames = argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 0) : 1200;
+    uint64_t bootCycles, runCycles;
+    double start, boot, run;
+    uint32_t hash = 2166136261u, i;
+    char name[9];
+    const char *c;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <rom> <program.8xp> [frames]\n", argv[0]);
+        return 1;
+    }
+    if (!program_name(argv[2], name)) {
+        fprintf(stderr, "[Error] Couldn't read the program name from %s\n", argv[2]);
+        return 1;
+    }
+    if (!emu_start(argv[1], NULL)) {
+        fprintf(stderr, "[Error] Couldn't start emulation with %s\n", argv[1]);
+        return 1;
+    }
+    emu_reset();
+
+    start = cpu_seconds();
+    bootCycles = emu_run_frames(BOOT_FRAMES);
+    boot = cpu_seconds() - start;
+
+    if (!sendVariableLink(argv[2], LINK_FILE)) {
+        fprintf(stderr, "[Error] Couldn't send %s\n", argv[2]);
+        emu_cleanup();
+        return 1;
+    }
+
+    start = cpu_seconds();
+    runCycles = emu_run_frames(KEY_FRAMES);
+    runCycles += press(CE_KEY_Clear);
+    runCycles += press(CE_KEY_Asm);
+    runCycles += press(CE_KEY_prgm);
+    for (c = name; *c; c++) {
+        sendLetterKeyPress(*c);
+        runCycles += emu_run_frames(KEY_FRAMES);
+    }
+    runCycles += press(CE_KEY_Enter);
+    runCycles += emu_run_frames(frames);
+    run = cpu_seconds() - start;
+
+    /* lets runs of differently built cores be checked for the same result */
+    for (i = 0; i < ram_size; i++) {
+        hash = (hash ^ mem.ram.block[i]) * 16777619u;
+    }
+
+    printf("%-8s boot %7.3fs %12llu cycles   run %7.3fs %12llu cycles   ram %08x\n", name,
+           boot, (unsigned long long)bootCycles, run, (unsigned long long)runCycles, hash);
+
+    emu_cleanup();
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Scheduler ratio test
+ * Checks that ratio_mul gives exactly the results of muldiv for every pair of
+ * clock rates the core uses, then times both conversions.
+ * Part of the CEmu project
+ * License: GPLv3
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* for the static helpers; cpu is its only outside dependency */
+#include "../../core/schedule.c"
+
+eZ80cpu_t cpu;
+
+#define SWEEP_INPUTS    (1U << 22)
+#define RANDOM_INPUTS   (1U << 22)
+#define EDGE_MULTIPLES  4096
+#define BENCH_INPUTS    (1U << 27)
+
+/* cpu rates set through the control port, then the default rates */
+static const uint32_t cpuRates[] = { 6000000, 12000000, 24000000, 48000000 };
+static const uint32_t clockRates[CLOCK_NUM_ITEMS] = { 48000000, 78000000, 27000000, 12000000, 24000000, 32768 };
+
+static uint32_t rng = 2463534242u;
+static uint32_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static unsigned long failures;
+
+static void check(const char *name, uint32_t a, uint32_t b, uint32_t c, const sched_ratio_t *r) {
+    uint32_t expected, got;
+    if ((uint64_t)a * b / c >> 32) {
+        return; /* muldiv can't represent it either */
+    }
+    expected = muldiv(a, b, c);
+    got = ratio_mul(a, r);
+    if (expected != got && failures++ < 10) {
+        printf("[Error] %s: %u * %u / %u = %u, got %u\n", name, a, b, c, expected, got);
+    }
+}
+
+/* Every small input, inputs around multiples of c, where rounding errors
+ * would show first, the largest inputs and random ones */
+static void check_ratio(const char *name, uint32_t b, uint32_t c, const sched_ratio_t *r) {
+    uint64_t max = ((uint64_t)c << 32) / b, k;
+    uint32_t i;
+    if (max > UINT32_MAX) {
+        max = UINT32_MAX;
+    }
+    for (i = 0; i < SWEEP_INPUTS; i++) {
+        check(name, i, b, c, r);
+    }
+    for (k = 1; k <= EDGE_MULTIPLES && k * c <= max; k++) {
+        check(name, (uint32_t)(k * c - 1), b, c, r);
+        check(name, (uint32_t)(k * c), b, c, r);
+        check(name, (uint32_t)(k * c + 1), b, c, r);
+    }
+    for (k = max - SWEEP_INPUTS; k <= max; k++) {
+        check(name, (uint32_t)k, b, c, r);
+    }
+    for (i = 0; i < RANDOM_INPUTS; i++) {
+        check(name, (uint32_t)(next_random() % (max + 1)), b, c, r);
+    }
+}
+
+static double cpu_seconds(void) {
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static void bench(void) {
+    const uint32_t b = clockRates[CLOCK_32K], c = cpuRates[3];
+    const sched_ratio_t *r = &ratios.fromCPU[CLOCK_32K];
+    volatile uint32_t sink = 0;
+    double start, withDiv, withRatio;
+    uint32_t i;
+
+    start = cpu_seconds();
+    for (i = 0; i < BENCH_INPUTS; i++) {
+        sink += muldiv(i, b, c);
+    }
+    withDiv = cpu_seconds() - start;
+
+    start = cpu_seconds();
+    for (i = 0; i < BENCH_INPUTS; i++) {
+        sink += ratio_mul(i, r);
+    }
+    withRatio = cpu_seconds() - start;
+
+    (void)sink;
+    printf("%u conversions: muldiv %.3fs, ratio_mul %.3fs\n", BENCH_INPUTS, withDiv, withRatio);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int i, j;
+
+    for (i = 0; i < sizeof(cpuRates) / sizeof(cpuRates[0]); i++) {
+        memcpy(sched.clockRates, clockRates, sizeof(clockRates));
+        sched.clockRates[CLOCK_CPU] = cpuRates[i];
+        sched_update_rates();
+        for (j = 0; j < CLOCK_NUM_ITEMS; j++) {
+            uint32_t cpuRate = sched.clockRates[CLOCK_CPU], rate = sched.clockRates[j];
+            check_ratio("toCPU", cpuRate, rate, &ratios.toCPU[j]);
+            check_ratio("fromCPU", rate, cpuRate, &ratios.fromCPU[j]);
+            check_ratio("perTick", 1, rate, &ratios.perTick[j]);
+        }
+    }
+    if (failures) {
+        printf("[Error] %lu conversions differ from muldiv\n", failures);
+        return 1;
+    }
+    printf("[OK] ratio_mul matches muldiv for all clock pairs\n");
+
+    if (argc > 1 && !strcmp(argv[1], "--bench")) {
+        bench();
+    }
+    return 0;
+}